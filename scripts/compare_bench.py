@@ -0,0 +1,49 @@
+import json
+import math
+import sys
+
+# Compares two JSON files written by the C++ benchmark (tests/bench.cpp), e.g. a `make bench` run
+# against a `make bench-faster` run, or a build before and after a change to Network. For every
+# case and phase present in both it prints the median of each and their ratio, and marks the
+# differences that are larger than the noise of either run. Exits with 1 if anything got slower by
+# more than the threshold (default 5%), so it can gate a change.
+#
+#   python3 compare_bench.py base.json new.json [threshold]
+
+def load(path):
+    with open(path) as f:
+        results = json.load(f)
+    phases = {}
+    for case in results["cases"]:
+        for phase, stats in case["phases"].items():
+            phases[(case["name"], phase)] = stats
+    return results["build"], phases
+
+def error(stats):
+    return stats["stddev_us"] / math.sqrt(stats["samples"])
+
+base_build, base = load(sys.argv[1])
+new_build, new = load(sys.argv[2])
+threshold = float(sys.argv[3]) if len(sys.argv) > 3 else 0.05
+
+def describe(build):
+    return "%s (%s, %s, kernels %s)" % (build["config"], build["compiler"], build["simd"], build.get("kernels", "?"))
+
+print("base: " + describe(base_build))
+print("new:  " + describe(new_build))
+print("%-36s %-9s %12s %12s %8s" % ("case", "phase", "base us", "new us", "ratio"))
+regressions = 0
+for key in sorted(base.keys() & new.keys()):
+    b = base[key]
+    n = new[key]
+    ratio = n["median_us"] / b["median_us"]
+    noise = 3 * math.hypot(error(b), error(n))
+    mark = ""
+    if abs(n["mean_us"] - b["mean_us"]) > noise:
+        mark = "faster" if ratio < 1 else "slower"
+        if ratio > 1 + threshold:
+            regressions += 1
+    if not (b["stable"] and n["stable"]):
+        mark += " (unstable)"
+    print("%-36s %-9s %12.3f %12.3f %8.3f %s" % (key[0], key[1], b["median_us"], n["median_us"], ratio, mark))
+sys.exit(1 if regressions else 0)
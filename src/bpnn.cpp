@@ -1,11 +1,15 @@
 #include "bpnn.hpp"
 #include "utils.hpp"
+#include "trace.hpp"
+#include "kernels.hpp"
+#include "validation.hpp"
 #include <ctime>
+#include <cstdlib>
 #include <random>
-
-#define SHUFFLED_PATH "./shuffled.txt"
-#define TEST_PATH "./test.txt"
-#define TRAIN_PATH "./train.txt"
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <sys/mman.h>
 
 #include "checks.cpp"
 
@@ -13,50 +17,269 @@ Layer::Layer(int batch_sz, int nodes)
 {
   contents = new Eigen::MatrixXf (batch_sz, nodes);
   dZ = new Eigen::MatrixXf (batch_sz, nodes);
+  rows = batch_sz;
   int datalen = batch_sz*nodes;
   for (int i = 0; i < datalen; i++) {
     (*contents)((int)i / nodes,i%nodes) = 0;
     (*dZ)((int)i / nodes,i%nodes) = 0;
   }
-  bias = new Eigen::MatrixXf (batch_sz, nodes);
-  for (int i = 0; i < nodes; i++) {
-    for (int j = 0; j < batch_sz; j++) {
-      (*bias)(j, i) = 0;
-    }
-  }
+  // The weights and the bias row (shared by the whole batch, broadcast in Layer::forward) are
+  // views into the network's Parameters, planned by Network::initialize().
 }
 
-void Layer::init_weights(Layer next)
+// Draws the weights feeding `next`, which Parameters::plan has already placed.
+void Layer::init_weights(Layer next, std::mt19937& gen)
 {
-  weights = new Eigen::MatrixXf (contents->cols(), next.contents->cols());
-  v = new Eigen::MatrixXf (contents->cols(), next.contents->cols());
   int nodes = weights->cols();
   int n = contents->cols() + next.contents->cols();
   std::normal_distribution<float> d(0,sqrt(1.0/n));
   for (int i = 0; i < (weights->rows()*weights->cols()); i++) {
-    std::random_device rd;
-    std::mt19937 gen(rd()); 
     (*weights)((int)i / nodes, i%nodes) = d(gen);
   }
-  for (int i = 0; i < (weights->rows()*weights->cols()); i++) {
-    (*v)((int)i / nodes, i%nodes) = 0;
+}
+
+static Eigen::Index padded(Eigen::Index n) {return (n + 15) & ~(Eigen::Index)15;}
+
+Eigen::Index parameter_layout(const std::vector<Layer>& layers, std::vector<Eigen::Index>& weights,
+                              std::vector<Eigen::Index>& biases)
+{
+  int length = layers.size();
+  Eigen::Index total = 0;
+  weights.assign(length, 0);
+  biases.assign(length, 0);
+  for (int i = 0; i < length-1; i++) {
+    weights[i] = total;
+    total += padded(layers[i].contents->cols() * layers[i+1].contents->cols());
+  }
+  for (int i = 0; i < length; i++) {
+    biases[i] = total;
+    total += padded(layers[i].contents->cols());
+  }
+  return total;
+}
+
+// Places every tensor and points the layers at it. Planning again, e.g. once an optimizer needs
+// second moments, keeps the values and v already there.
+void Parameters::plan(std::vector<Layer>& layers, bool second_moment)
+{
+  std::vector<Eigen::Index> weight_at, bias_at;
+  Eigen::Index total = parameter_layout(layers, weight_at, bias_at);
+  int wanted = second_moment ? 3 : 2;
+  float* next = (float*) aligned_alloc(64, wanted * total * sizeof(float));
+  std::fill(next, next + wanted * total, 0.0f);
+  if (arena != nullptr && total == size) std::copy(arena, arena + std::min(mirrors, wanted) * size, next);
+  release();
+  arena = next;
+  size = total;
+  mirrors = wanted;
+  place(layers);
+}
+
+// Points the layers at the tensors in arena, which already has the layout plan() gives it.
+void Parameters::place(std::vector<Layer>& layers)
+{
+  int length = layers.size();
+  std::vector<Eigen::Index> weight_at, bias_at;
+  parameter_layout(layers, weight_at, bias_at);
+  bool second_moment = mirrors > 2;
+  biases = bias_at[0];
+  trained_biases = length > 1 ? bias_at[1] : size;
+  views.clear();
+  views.reserve(6 * length);
+  auto view = [this](int mirror, Eigen::Index offset, Eigen::Index rows, Eigen::Index cols) -> ParamMap* {
+    views.emplace_back(arena + mirror * size + offset, rows, cols);
+    return &views.back();
+  };
+  for (int i = 0; i < length; i++) {
+    Layer& layer = layers[i];
+    Eigen::Index nodes = layer.contents->cols();
+    layer.bias = view(0, bias_at[i], 1, nodes);
+    layer.bias_v = view(1, bias_at[i], 1, nodes);
+    layer.bias_s = second_moment ? view(2, bias_at[i], 1, nodes) : nullptr;
+    if (i < length-1) {
+      Eigen::Index next_nodes = layers[i+1].contents->cols();
+      layer.weights = view(0, weight_at[i], nodes, next_nodes);
+      layer.v = view(1, weight_at[i], nodes, next_nodes);
+      layer.s = second_moment ? view(2, weight_at[i], nodes, next_nodes) : nullptr;
+    }
+  }
+}
+
+// Gives the arena back, whether it was allocated by plan() or mapped from a Snapshot.
+void Parameters::release()
+{
+  if (mapped > 0) munmap(arena, mapped);
+  else free(arena);
+  arena = nullptr;
+  mapped = 0;
+}
+
+Eigen::Map<Eigen::VectorXf, Eigen::Aligned64> Parameters::flat(int mirror)
+{
+  return Eigen::Map<Eigen::VectorXf, Eigen::Aligned64> (arena + mirror * size, size);
+}
+
+// FNV-1a over the bits of every value, e.g. to tell whether two runs or two copies agree exactly.
+uint64_t Parameters::checksum() const
+{
+  uint64_t hash = 14695981039346656037ull;
+  const uint32_t* bits = (const uint32_t*) arena;
+  for (Eigen::Index i = 0; i < size; i++) {
+    hash ^= bits[i];
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+// Allocates for batches of up to batch_size rows; use_rows picks how many the next one has.
+void Workspace::plan(std::vector<Layer>& layers, int batch_size)
+{
+  int length = layers.size();
+  std::vector<Eigen::Index> weights, biases;
+  grads_size = parameter_layout(layers, weights, biases);
+  Eigen::Index total = grads_size;
+  for (int i = 0; i < length; i++) total += padded(batch_size * layers[i].contents->cols());
+  free(arena);
+  arena = (float*) aligned_alloc(64, total * sizeof(float));
+  std::fill(arena, arena + total, 0.0f);
+  grads = arena;
+  gradients.clear();
+  deltas.clear();
+  bias_grads.clear();
+  float* next = arena + grads_size;
+  for (int i = length-1; i >= 0; i--) {
+    Eigen::Index nodes = layers[i].contents->cols();
+    gradients.emplace_back(next, batch_size, nodes);
+    next += padded(batch_size * nodes);
+    bias_grads.emplace_back(grads + biases[i], nodes);
+    if (i > 0) deltas.emplace_back(grads + weights[i-1], layers[i-1].contents->cols(), nodes);
+  }
+  rows = batch_size;
+}
+
+// Remaps the error matrices onto their first n rows' worth of floats, without reallocating.
+void Workspace::use_rows(int n)
+{
+  rows = n;
+  for (Eigen::Map<Eigen::MatrixXf>& error : gradients) {
+    new (&error) Eigen::Map<Eigen::MatrixXf> (error.data(), n, error.cols());
   }
 }
 
+// Points a set of layers and their workspace at a batch of `rows` rows. Each layer's batch is the
+// first rows x nodes floats of its buffers, so it is contiguous whatever its size.
+void set_batch_rows(std::vector<Layer>& layers, Workspace& workspace, int rows)
+{
+  for (Layer& layer : layers) layer.rows = rows;
+  workspace.use_rows(rows);
+}
+
+Eigen::Map<Eigen::VectorXf, Eigen::Aligned64> Workspace::flat_grads()
+{
+  return Eigen::Map<Eigen::VectorXf, Eigen::Aligned64> (grads, grads_size);
+}
+
 Network::Network(char* path, int batch_sz, float learn_rate, float bias_rate, float l, float ratio)
-  :lambda{l}, learning_rate{learn_rate}, bias_lr{bias_rate}, batch_size{batch_sz}
+  :Network(open_dataset(path), batch_sz, learn_rate, bias_rate, l, ratio)
 {
-  int total_instances = prep_file(path, SHUFFLED_PATH);
-  test_instances = split_file(SHUFFLED_PATH, total_instances, ratio);
-  instances = total_instances - test_instances;
-  data = fopen(TRAIN_PATH, "r");
+  opened = data;
+}
+
+// Trains on an already opened dataset, which several networks can share (see Sweep).
+Network::Network(Dataset* dataset, int batch_sz, float learn_rate, float bias_rate, float l, float ratio)
+  :data{dataset}, ratio{ratio}, learning_rate{learn_rate}, bias_lr{bias_rate}, lambda{l}, batch_size{batch_sz},
+   max_batch{batch_sz}, batch_rows{batch_sz}
+{
+  std::random_device rd;
+  rng.seed(rd());
+  if (data != nullptr) dataset_rows = data->rows;
+  split_rows();
   decay = [](float lr, float t) -> float {
     return lr;
   };
 }
 
+// No data yet: pass arrays to fit() after initialize().
+Network::Network(int batch_sz, float learn_rate, float bias_rate, float l, float ratio)
+  :Network((Dataset*) nullptr, batch_sz, learn_rate, bias_rate, l, ratio)
+{
+}
+
+// Frees everything the network allocated. A dataset passed in by the caller is left alone.
+Network::~Network()
+{
+  delete validator;
+  delete pipeline;
+  free_replicas();
+  delete pool;
+  for (Layer& layer : layers) {
+    delete layer.contents;
+    delete layer.dZ;
+  }
+  delete labels;
+  free(workspace.arena);
+  params.release();
+  delete borrowed;
+  delete opened;
+}
+
+Eigen::Map<Eigen::MatrixXf> Layer::batch()
+{
+  return Eigen::Map<Eigen::MatrixXf> (contents->data(), rows, contents->cols());
+}
+
+Eigen::Map<Eigen::MatrixXf> Layer::batch_dZ()
+{
+  return Eigen::Map<Eigen::MatrixXf> (dZ->data(), rows, dZ->cols());
+}
+
+void Layer::activate()
+{
+  activate(0, contents->cols());
+}
+
+// Activates columns [col, col+n). Columns are contiguous in Eigen's column-major storage.
+void Layer::activate(int col, int n)
+{
+  float* z = contents->data() + (Eigen::Index)col * rows;
+  float* d = dZ->data() + (Eigen::Index)col * rows;
+  Eigen::Index len = (Eigen::Index)n * rows;
+  if (activation_kind != Activation::Custom) {
+    apply_activation(activation_kind, z, d, len);
+    return;
+  }
+  for (Eigen::Index i = 0; i < len; i++) {
+    d[i] = activation_deriv(z[i]);
+    z[i] = activation(z[i]);
+  }
+}
+
+// Fused forward kernel: contents = input * w + bias, then the activation and its derivative.
+// Output is produced FORWARD_BLOCK floats worth of columns at a time so the bias and activation
+// passes hit the block while it is still in cache instead of streaming the whole layer three times.
+void Layer::forward(Eigen::Ref<const Eigen::MatrixXf> input, Eigen::Ref<const Eigen::MatrixXf> w, int index)
+{
+  Eigen::Map<Eigen::MatrixXf> z = batch();
+  int cols = contents->cols();
+  int block = std::max(1, FORWARD_BLOCK / std::max(rows, 1));
+  for (int c = 0; c < cols; c += block) {
+    int n = std::min(block, cols - c);
+    auto out = z.middleCols(c, n);
+    {
+      TRACE("gemm", index);
+      out.noalias() = input * w.middleCols(c, n);
+      out.rowwise() += bias->row(0).segment(c, n);
+    }
+    TRACE("activation", index);
+    activate(c, n);
+  }
+}
+
 void Network::init_decay(char* type, float a_0, float k)
 {
+  strncpy(decay_type, type, sizeof(decay_type)-1);
+  decay_a0 = a_0;
+  decay_k = k;
   if (strcmp(type, "step") == 0) {
     decay = [a_0, k](float lr, float t) -> float {
       return lr/k;
@@ -77,106 +300,255 @@ void Network::init_decay(char* type, float a_0, float k)
 void Network::add_layer(int nodes, char* name)
 {
   length++;
-  layers.emplace_back(batch_size, nodes);
+  layers.emplace_back(max_batch, nodes);
   strcpy(layers[length-1].activation_str, name);
   if (strcmp(name, "sigmoid") == 0) {
+    layers[length-1].activation_kind = Activation::Sigmoid;
     layers[length-1].activation = sigmoid;
     layers[length-1].activation_deriv = sigmoid_deriv;
   }
   else if (strcmp(name, "linear") == 0) {
+    layers[length-1].activation_kind = Activation::Linear;
     layers[length-1].activation = linear;
     layers[length-1].activation_deriv = linear_deriv;
   }
   else if (strcmp(name, "step") == 0) {
+    layers[length-1].activation_kind = Activation::Step;
     layers[length-1].activation = step;
     layers[length-1].activation_deriv = step_deriv;
   }
   else if (strcmp(name, "lecun_tanh") == 0) {
+    layers[length-1].activation_kind = Activation::LecunTanh;
     layers[length-1].activation = lecun_tanh;
     layers[length-1].activation_deriv = lecun_tanh_deriv;
   }
   else if (strcmp(name, "inverse_logit") == 0) {
+    layers[length-1].activation_kind = Activation::InverseLogit;
     layers[length-1].activation = inverse_logit;
     layers[length-1].activation_deriv = inverse_logit_deriv;
   }
   else if (strcmp(name, "cloglog") == 0) {
+    layers[length-1].activation_kind = Activation::Cloglog;
     layers[length-1].activation = cloglog;
     layers[length-1].activation_deriv = cloglog_deriv;
   }
   else if (strcmp(name, "softplus") == 0) {
+    layers[length-1].activation_kind = Activation::Softplus;
     layers[length-1].activation = softplus;
     layers[length-1].activation_deriv = softplus_deriv;
   }
   else if (strcmp(name, "relu") == 0) {
+    layers[length-1].activation_kind = Activation::Relu;
     layers[length-1].activation = rectifier(linear);
     layers[length-1].activation_deriv = rectifier(linear_deriv);
   }
   else if (strcmp(name, "resig") == 0) {
+    layers[length-1].activation_kind = Activation::Resig;
     layers[length-1].activation = rectifier(sigmoid);
     layers[length-1].activation_deriv = rectifier(sigmoid_deriv);
   }
   else {
-    std::cout << "Warning! Incorrect activation specified. Exiting...\n\nIf this is coming up and you don't know why, try defining your own activation function.\n";
-    exit(1);
+    layers.pop_back();
+    length--;
+    throw std::invalid_argument(std::string("Unknown activation `") + name + "`! Add the layer with a built-in activation, then replace it with your own.");
   }
 }
 
 void Network::initialize()
 {
-  labels = new Eigen::MatrixXf (batch_size,layers[length-1].contents->cols());
+  delete labels;
+  labels = new Eigen::MatrixXf (max_batch,layers[length-1].contents->cols());
+  params.plan(layers, second_moment(optimizer.kind));
   for (int i = 0; i < length-1; i++) {
-    layers[i].init_weights(layers[i+1]);
+    layers[i].init_weights(layers[i+1], rng);
   }
+  workspace.plan(layers, max_batch);
+  use_rows(batch_size);
+  reset_optimizer();
+  weight_norm = squared_weights();
+  drop_validator();
+}
+
+// Trains on batches of `rows` rows from the next batch on, e.g. 1 for online updates. Buffers are
+// only reallocated the first time a batch is larger than any before (see reserve_batch).
+void Network::set_batch_size(int rows)
+{
+  if (rows < 1) throw std::invalid_argument("batch size must be at least 1");
+  batch_size = rows;
+  reserve_batch(rows);
+  if (workspace.arena != nullptr) use_rows(rows);
+}
+
+// Grows the batch size during training: every `every` epochs it is multiplied by factor, up to
+// `largest` rows. Buffers are allocated for `largest` right away, so the growth never reallocates.
+// every == 0 turns it off.
+void Network::set_batch_schedule(float factor, int every, int largest)
+{
+  batch_growth = factor;
+  growth_every = every;
+  largest_batch = largest;
+  if (every > 0) reserve_batch(largest);
+}
+
+// Makes room for batches of up to `capacity` rows in the layers, labels, workspace, replicas and
+// prefetch ring. Smaller batches are row-block views of the same buffers.
+void Network::reserve_batch(int capacity)
+{
+  if (capacity <= max_batch) return;
+  max_batch = capacity;
+  for (Layer& layer : layers) {
+    int nodes = layer.contents->cols();
+    delete layer.contents;
+    delete layer.dZ;
+    layer.contents = new Eigen::MatrixXf (Eigen::MatrixXf::Zero(capacity, nodes));
+    layer.dZ = new Eigen::MatrixXf (Eigen::MatrixXf::Zero(capacity, nodes));
+  }
+  if (workspace.arena == nullptr) return; // initialize() sizes the rest
+  delete labels;
+  labels = new Eigen::MatrixXf (Eigen::MatrixXf::Zero(capacity, layers[length-1].contents->cols()));
+  workspace.plan(layers, capacity);
+  use_rows(batch_rows);
+  set_prefetch(prefetch_depth);
+  if (!replicas.empty()) build_replicas();
+}
+
+// Makes the next feedforward() and backpropagate() work on the first n rows of the batch buffers.
+void Network::use_rows(int n)
+{
+  batch_rows = n;
+  set_batch_rows(layers, workspace, n);
+}
+
+// Selects how apply_gradients turns gradients into updates: "sgd" (the default), "momentum",
+// "nesterov", "adam", "adamw" or "rmsprop". See OptimizerConfig for what beta1 and beta2 mean to
+// each. Resets the optimizer's state if the network is already initialized.
+void Network::init_optimizer(char* type, float beta1, float beta2, float epsilon)
+{
+  optimizer.kind = optimizer_kind(type);
+  optimizer.beta1 = beta1;
+  optimizer.beta2 = beta2;
+  optimizer.epsilon = epsilon;
+  if (workspace.arena != nullptr) reset_optimizer();
+}
+
+// Zeroes the optimizer state next to every weight matrix and bias, making room for second
+// moments the first time the optimizer needs them.
+void Network::reset_optimizer()
+{
+  if (second_moment(optimizer.kind) && params.mirrors < 3) {
+    params.plan(layers, true);
+    if (!replicas.empty()) build_replicas();
+  }
+  for (int m = 1; m < params.mirrors; m++) params.flat(m).setZero();
+  steps = 0;
+}
+
+// Reseeds the generator behind the train/validation split, the epoch shuffles and weight
+// initialization, and redoes the split so the whole run is reproducible from here on.
+void Network::seed(unsigned int s)
+{
+  rng.seed(s);
+  split_rows();
+}
+
+// chunk == 0 shuffles the whole training set every epoch. Otherwise rows are kept in storage order,
+// cut into chunks of `chunk` rows, and only the chunk order and the rows inside each chunk are shuffled,
+// so each batch reads from one or two nearby regions of the mapping.
+void Network::set_shuffle(int chunk)
+{
+  shuffle_chunk = chunk;
+}
+
+void Network::split_rows()
+{
+  int total = dataset_rows;
+  std::vector<int> rows (total);
+  for (int i = 0; i < total; i++) rows[i] = i;
+  std::shuffle(rows.begin(), rows.end(), rng);
+  instances = round(ratio * total);
+  test_instances = total - instances;
+  train_rows.assign(rows.begin(), rows.begin() + instances);
+  test_rows.assign(rows.begin() + instances, rows.end());
+  std::sort(train_rows.begin(), train_rows.end());
+  std::sort(test_rows.begin(), test_rows.end());
+  shuffle_rows();
+  drop_validator();
+}
+
+void Network::shuffle_rows()
+{
+  TRACE("shuffle");
+  if (shuffle_chunk <= 0) {
+    std::shuffle(train_rows.begin(), train_rows.end(), rng);
+    return;
+  }
+  std::sort(train_rows.begin(), train_rows.end());
+  int chunks = (instances + shuffle_chunk - 1) / shuffle_chunk;
+  std::vector<int> order (chunks);
+  for (int i = 0; i < chunks; i++) order[i] = i;
+  std::shuffle(order.begin(), order.end(), rng);
+  std::vector<int> shuffled;
+  shuffled.reserve(instances);
+  for (int c : order) {
+    auto first = train_rows.begin() + c * shuffle_chunk;
+    auto last = train_rows.begin() + std::min(instances, (c+1) * shuffle_chunk);
+    int start = shuffled.size();
+    shuffled.insert(shuffled.end(), first, last);
+    std::shuffle(shuffled.begin() + start, shuffled.end(), rng);
+  }
+  train_rows.swap(shuffled);
 }
 
 void Network::set_activation(int index, std::function<float(float)> custom, std::function<float(float)> custom_deriv)
 {
   layers[index].activation = custom;
   layers[index].activation_deriv = custom_deriv;
+  layers[index].activation_kind = Activation::Custom;
+  drop_validator();
 }
 
-void Network::feedforward()
+// Overwrites the first datalen/cols rows of a layer's activations with row-major values.
+void Network::update_layer(float* vals, int datalen, int index)
 {
-  for (int j = 0; j < layers[0].contents->rows(); j++) {
-    for (int k = 0; k < layers[0].contents->cols(); k++) {
-      (*layers[0].dZ)(j,k) = layers[0].activation_deriv((*layers[0].contents)(j,k));
-      (*layers[0].contents)(j,k) = layers[0].activation((*layers[0].contents)(j,k));
-    }
+  Eigen::Map<Eigen::MatrixXf> contents = layers[index].batch();
+  int cols = contents.cols();
+  contents.topRows(datalen / cols) = Eigen::Map<RowMatrixXf>(vals, datalen / cols, cols);
+}
+
+// Forward pass over any set of layers, so data-parallel replicas can run it on their own slice.
+// The output layer goes through one fused kernel that leaves the softmax in place, adds the loss
+// and correct rows against labels to stats, and, given a workspace, writes the output error that
+// compute_gradients starts from. With members > 1 the output layer holds that many models side by
+// side (see Ensemble); each gets its own softmax over its block of columns and its own entry of stats.
+void forward_pass(std::vector<Layer>& layers, const Eigen::MatrixXf& labels, Workspace* workspace, OutputStats* stats, int members)
+{
+  int length = layers.size();
+  {
+    TRACE("forward", 0);
+    layers[0].activate();
   }
   for (int i = 0; i < length-1; i++) {
-    //if (batch_size > 64 && batch_size % 4 == 0) {
-    //  *layers[i+1].contents = strassen_mul((*layers[i].contents),(*layers[i].weights));
-    //}
-    *layers[i+1].contents = (*layers[i].contents) * (*layers[i].weights);
-    *layers[i+1].contents += *layers[i+1].bias;
-  }
-  for (int i = 1; i < length; i++) {
-    for (int j = 0; j < layers[i].contents->rows(); j++) {
-      for (int k = 0; k < layers[i].contents->cols(); k++) {
-        (*layers[i].dZ)(j,k) = layers[i].activation_deriv((*layers[i].contents)(j,k));
-        (*layers[i].contents)(j,k) = layers[i].activation((*layers[i].contents)(j,k));
-      }
-    }
-  }
-  for (int i = 0; i < layers[length-1].contents->rows(); i++) {
-    float sum = 0;
-    Eigen::MatrixXf m = layers[length-1].contents->block(i,0,1,layers[length-1].contents->cols());
-    Eigen::MatrixXf::Index maxRow, maxCol;
-    float max = m.maxCoeff(&maxRow, &maxCol);
-    m = (m.array() - max).matrix();
-    for (int j = 0; j < layers[length-1].contents->cols(); j++) {
-      checknan(m(0,j), "input to final layer");
-      sum += exp(m(0,j));
-      checknan(sum, "sum in Softmax operation");
-    }
-    for (int j = 0; j < layers[length-1].contents->cols(); j++) {
-      m(0,j) = exp(m(0,j))/sum;
-      checknan(m(0,j), "output of Softmax operation");
-    }
-    layers[length-1].contents->block(i,0,1,layers[length-1].contents->cols()) = m;
+    TRACE("forward", i+1);
+    layers[i+1].forward(layers[i].batch(), *layers[i].weights, i+1);
+  }
+  TRACE("softmax");
+  Eigen::Map<Eigen::MatrixXf> out = layers[length-1].batch();
+  int classes = out.cols() / members;
+  for (int k = 0; k < members; k++) {
+    Eigen::Index offset = (Eigen::Index)k*classes*out.rows();
+    float* error = workspace != nullptr ? workspace->gradients[0].data() + offset : nullptr;
+    stats[k] = OutputStats();
+    float sum = kernels->softmax_loss(out.data() + offset, out.rows(), classes, 1, out.rows(), labels.data(),
+                                      error, &stats[k].loss, &stats[k].correct);
+    checknan(sum, "sum in Softmax operation");
   }
 }
 
+void Network::feedforward()
+{
+  forward_pass(layers, *labels, &workspace, &stats);
+}
+
 void Network::list_net()
 {
   std::cout << "-----------------------\nINPUT LAYER (LAYER 0)\n-----------------------\n\n\u001b[31mGENERAL INFO:\x1B[0;37m\nActivation Function: " << layers[0].activation_str << "\n\n\u001b[31mACTIVATIONS:\x1B[0;37m\n" << *layers[0].contents << "\n\n\u001b[31mWEIGHTS:\x1B[0;37m\n" << *layers[0].weights << "\n\n\u001b[31mBIASES:\x1B[0;37m\n" << *layers[0].bias << "\n\n\n";
@@ -186,234 +558,462 @@ void Network::list_net()
   std::cout << "-----------------------\nOUTPUT LAYER (LAYER " << length-1 << ")\n-----------------------\n\n\u001b[31mGENERAL INFO:\x1B[0;37m\nActivation Function: " << layers[length-1].activation_str <<"\n\n\u001b[31mACTIVATIONS:\x1B[0;37m\n" << *layers[length-1].contents << "\n\n\u001b[31BIASES:\x1B[0;37m\n" << *layers[length-1].bias <<  "\n\n\n";
 }
 
+// Cost of the last batch fed forward, from what the fused output pass already summed.
 float Network::cost()
 {
-  float sum = 0;
-  float reg = 0; // Regularization term
-  for (int i = 0; i < layers[length-1].contents->rows(); i++) {
-    float tempsum = 0;
-    for (int j = 0; j < layers[length-1].contents->cols(); j++) {
-      float truth;
-      if (j==(*labels)(i,0)) truth = 1;
-      else truth = 0;
-      if ((*layers[length-1].contents)(i,j) == 0) (*layers[length-1].contents)(i,j) += 0.00001;
-      // std::cout << truth << " VS " << (*layers[length-1].contents)(i,j) << " SO " << truth * log((*layers[length-1].contents)(i,j)) << "\n";
-      tempsum += truth * log((*layers[length-1].contents)(i,j));
-      checknan(tempsum, "summation for row inside cost calculation");
-    }
-    sum-=tempsum;
-    checknan(tempsum, "total summation inside cost calculation");
-  }
-  for (int i = 0; i < layers.size()-1; i++) {
-    reg += (layers[i].weights->cwiseProduct(*layers[i].weights)).sum();
-  }
-  return ((1.0/batch_size) * sum) + (1/2*lambda*reg);
+  return (1.0/batch_rows) * stats.loss + (0.5f*lambda*weight_norm);
+}
+
+float Network::cost(Eigen::Ref<Eigen::MatrixXf> out, Eigen::Ref<Eigen::MatrixXf> targets)
+{
+  TRACE("cost");
+  return cross_entropy(out, targets) + (0.5f*lambda*weight_norm);
+}
+
+// Sum of the squared weights from scratch, for when they change outside apply_gradients.
+float Network::squared_weights()
+{
+  return params.flat().head(params.biases).squaredNorm();
+}
+
+uint64_t Network::checksum()
+{
+  return params.checksum();
+}
+
+// Mean cross-entropy of a batch of softmax outputs against integer labels, without the penalty.
+float Network::cross_entropy(Eigen::Ref<Eigen::MatrixXf> out, Eigen::Ref<Eigen::MatrixXf> targets)
+{
+  float sum = kernels->cross_entropy(out.data(), out.rows(), out.cols(), 1, out.outerStride(), targets.data());
+  checknan(sum, "total summation inside cost calculation");
+  return (1.0/out.rows()) * sum;
 }
 
 float Network::accuracy()
 {
-  float correct = 0;
-  for (int i = 0; i < layers[length-1].contents->rows(); i++) {
-    float ans = -INFINITY;
-    float index = -1;
-    for (int j = 0; j < layers[length-1].contents->cols(); j++) {
-      if ((*layers[length-1].contents)(i, j) > ans) {
-        ans = (*layers[length-1].contents)(i, j);
-        index = j;
-        //std::cout << "UPDATE ANS: " << index << " as "<< (*layers[length-1].contents)(i, j) << " so " << ans << "\n";
-      }
-    }
-    //std::cout << (*labels)(i, 0) << " " << index << "\n";
-    if ((*labels)(i, 0) == index) correct += 1;
-  }
-  return (1.0/batch_size) * correct;
+  return (1.0/batch_rows) * stats.correct;
 }
 
-void Network::backpropagate()
+float Network::accuracy(Eigen::Ref<Eigen::MatrixXf> out, Eigen::Ref<Eigen::MatrixXf> targets)
 {
-  std::vector<Eigen::MatrixXf> gradients;
-  std::vector<Eigen::MatrixXf> deltas;
-  Eigen::MatrixXf error (layers[length-1].contents->rows(), layers[length-1].contents->cols());
-  // std::cout << (*layers[length-1].contents) << "\n\n\n";
-  //  std::cout << "OUTPUT:\n" << (*layers[length-1].contents) << "\n\n";
-  //  std::cout << "WEIGHT\n" << (*layers[length-2].weights) << "\n\n";
-  //  std::cout << "X:\n" << (*layers[length-2].contents) << "\n\n";
-  for (int i = 0; i < error.rows(); i++) {
-    for (int j = 0; j < error.cols(); j++) {
-      float truth;
-      if (j==(*labels)(i,0)) truth = 1;
-      else truth = 0;
-      error(i,j) = truth - (*layers[length-1].contents)(i,j);
-      checknan(error(i,j), "gradient of final layer");
-      // std::cout << truth << "[as label is "<< (*labels)(i,0) <<"] - " << (*layers[length-1].contents)(i,j) << "[aka index " << i << " " << j << "] = " << error(i,j) << "\n";
-    }
+  TRACE("accuracy");
+  float correct = kernels->accuracy(out.data(), out.rows(), out.cols(), 1, out.outerStride(), targets.data());
+  return (1.0/out.rows()) * correct;
+}
+
+// Fills the workspace with the gradients of one batch without touching the parameters. Everything
+// stays inside the workspace planned by initialize(): products are written with noalias() straight
+// into their preallocated slices. The output error (softmax + cross-entropy with respect to the
+// output layer's inputs) is already in gradients[0], written by forward_pass.
+void compute_gradients(std::vector<Layer>& layers, Workspace& workspace)
+{
+  int length = layers.size();
+  std::vector<Eigen::Map<Eigen::MatrixXf>>& gradients = workspace.gradients;
+  std::vector<Eigen::Map<Eigen::MatrixXf>>& deltas = workspace.deltas;
+  {
+    TRACE("backward", length-1);
+    deltas[0].noalias() = layers[length-2].batch().transpose() * gradients[0];
+    workspace.bias_grads[0].noalias() = gradients[0].colwise().sum();
   }
-  //  std::cout << error << "\n\n";
-  gradients.push_back(error);
-  deltas.push_back((*layers[length-2].contents).transpose() * gradients[0]);
-  //  std::cout << deltas[0] << "\n\n";
-  //  gradients[523] += error;
   int counter = 1;
   for (int i = length-2; i >= 1; i--) {
-    gradients.push_back((gradients[counter-1] * layers[i].weights->transpose()).cwiseProduct(*layers[i].dZ));
-    deltas.push_back(layers[i-1].contents->transpose() * gradients[counter]);
+    TRACE("backward", i);
+    gradients[counter].noalias() = gradients[counter-1] * layers[i].weights->transpose();
+    gradients[counter].array() *= layers[i].batch_dZ().array();
+    deltas[counter].noalias() = layers[i-1].batch().transpose() * gradients[counter];
+    workspace.bias_grads[counter].noalias() = gradients[counter].colwise().sum();
     counter++;
   }
-  //  std::cout << "GRAD:\n"<< gradients[0] << "\n\n";
-  //  std::cout << "DELTA:\n"<< deltas[0] << "\n\n";
-  // std::cout << "-------\nGRADS INCOMING" << "\n\n";
-  // for (Eigen::MatrixXf i : gradients) {
-  //   std::cout << i << "\n\n";
-  // }
-  // std::cout << "-------\nDELTAS INCOMING" << "\n\n";
-  // for (Eigen::MatrixXf i : deltas) {
-  //   std::cout << i << "\n\n";
-  // }
-  for (int i = 0; i < length-1; i++) {
-    *layers[length-2-i].weights -= (learning_rate * deltas[i]) + ((lambda/batch_size) * (*layers[length-2-i].weights));
-    //*layers[length-2-i].v = (0.9 * *layers[length-2-i].v) - ((learning_rate * deltas[i]));
-    //*layers[length-2-i].weights += *layers[length-2-i].v;
-    *layers[length-1-i].bias -= bias_lr * gradients[i];
-  }
-  //  std::cout << "NEW WEIGHT:\n" << (*layers[length-2].weights) << "\n\n\n\n";
 }
 
-void Network::update_layer(float* vals, int datalen, int index)
+// Applies the weight and bias gradients held in a workspace, in place, through the optimizer. The
+// SGD-style optimizers keep the L2 shrink SGD has always used; Adam adds the penalty to the
+// gradient and AdamW decays the weights separately from the step. Since the workspace gradients
+// share the layout of Parameters, that is one streaming update over every weight matrix and one
+// over every trained bias. rows is how many rows the gradients were summed over. Returns the new
+// sum of the squared weights, gathered on the way.
+float Network::apply_gradients(Workspace& ws, int rows)
 {
-  for (int i = 0; i < datalen; i++) {
-    (*layers[index].contents)((int)i / layers[index].contents->cols(),i%layers[index].contents->cols()) = vals[i];
+  TRACE("update");
+  long t = ++steps; // this update's own step, for bias correction, however many workers update at once
+  bool adaptive = optimizer.kind == Optimizer::Adam || optimizer.kind == Optimizer::AdamW;
+  float shrink = adaptive ? 1 : 1 - lambda/rows;
+  float l2 = optimizer.kind == Optimizer::Adam ? lambda*rows : 0;
+  float* v = params.arena + params.size;
+  float* s = params.mirrors > 2 ? params.arena + 2*params.size : nullptr;
+  float squares = apply_update(optimizer, params.arena, v, s, ws.grads, params.biases,
+                               learning_rate, shrink, lambda, l2, t);
+  Eigen::Index b = params.trained_biases;
+  apply_update(optimizer, params.arena + b, v + b, s != nullptr ? s + b : nullptr, ws.grads + b, params.size - b,
+               bias_lr, 1, 0, 0, t);
+  return squares;
+}
+
+void Network::backpropagate()
+{
+  compute_gradients(layers, workspace);
+  weight_norm = apply_gradients(workspace, batch_rows);
+}
+
+// Spreads the micro-batches of every step over `threads` workers. 1 (the default) trains on the
+// calling thread. Since the micro-batches and the order their gradients are added in do not depend
+// on the workers, the result is bit-for-bit the same for any thread count. Call after initialize().
+void Network::set_threads(int threads)
+{
+  asynchronous = false;
+  delete pool;
+  pool = threads > 1 ? new ThreadPool (threads) : nullptr;
+  free_replicas(); // rebuilt by micro_step when a batch needs them
+}
+
+// Hogwild-style asynchronous SGD: `threads` workers each stream their own share of the epoch's
+// batches and write their updates straight into the shared weights and biases with no locking.
+// Updates from different workers race by design; for small models the lost updates cost far less
+// than any synchronization would. 1 turns it back off. Call after initialize().
+void Network::set_async(int threads)
+{
+  asynchronous = threads > 1;
+  delete pool;
+  pool = threads > 1 ? new ThreadPool (threads) : nullptr;
+  build_replicas();
+}
+
+// Cuts every training batch into `parts` micro-batches (MICRO_BATCHES by default), which bounds how
+// many workers set_threads can keep busy. Each one holds its own copy of the gradients. 1 trains on
+// the whole batch in one pass, as feedforward() and backpropagate() do.
+void Network::set_micro_batches(int parts)
+{
+  if (parts < 1) throw std::invalid_argument("micro-batch count must be at least 1");
+  micro_batches = parts;
+  if (!replicas.empty()) build_replicas();
+}
+
+// Builds one replica per micro-batch, sized for the largest slice micro_step can hand it, or with
+// set_async one per worker, sized for a whole batch. micro_step and hogwild_epoch set the rows of
+// each step.
+void Network::build_replicas()
+{
+  free_replicas();
+  int count = asynchronous ? pool->size() : micro_batches;
+  int slice = std::max(std::min(MICRO_BATCH_ROWS, max_batch), (max_batch + count - 1) / count);
+  for (int t = 0; t < count; t++) {
+    Replica replica;
+    replica.rows = asynchronous ? max_batch : slice;
+    replica.offset = 0;
+    replica.stats.resize(members);
+    replica.layers = layers;
+    for (Layer& layer : replica.layers) {
+      layer.contents = new Eigen::MatrixXf (replica.rows, layer.contents->cols());
+      layer.dZ = new Eigen::MatrixXf (replica.rows, layer.contents->cols());
+      layer.contents->setZero();
+      layer.dZ->setZero();
+      layer.rows = replica.rows;
+    }
+    replica.labels = new Eigen::MatrixXf (replica.rows, labels->cols());
+    replica.labels->setZero();
+    replica.workspace.plan(replica.layers, replica.rows);
+    replicas.push_back(replica);
   }
 }
 
-int Network::next_batch()
+// Frees what build_replicas allocated for each replica.
+void Network::free_replicas()
 {
-  char line[MAXLINE] = {' '};
-  int inputs = layers[0].contents->cols();
-  int datalen = batch_size * inputs;
-  float batch[datalen];
-  for (int i = 0; i < batch_size; i++) {
-    fgets(line, MAXLINE, data);
-    char *p;
-    p = strtok(line,",");
-    for (int j = 0; j < inputs; j++) {
-      batch[j + (i * inputs)] = strtod(p, NULL);
-      p = strtok(NULL,",");
+  for (Replica& replica : replicas) {
+    for (Layer& layer : replica.layers) {
+      delete layer.contents;
+      delete layer.dZ;
     }
-    (*labels)(i, 0) = strtod(p, NULL);
+    delete replica.labels;
+    free(replica.workspace.arena);
   }
-  float* batchptr = batch;
-  update_layer(batchptr, datalen, 0);
-  return 0;
+  replicas.clear();
+}
+
+// Adds one micro-batch's weight and bias gradients to another's. Empty slices (from batches too small
+// to fill every micro-batch) are all at the end, so they are only ever absorbed, and skipped.
+static void absorb(Replica& into, Replica& from)
+{
+  if (from.rows == 0) return;
+  TRACE("reduce");
+  into.workspace.flat_grads() += from.workspace.flat_grads();
 }
 
-int prep_file(char* path, char* out_path)
+// Runs the forward and backward pass of the current batch as up to micro_batches slices of (almost)
+// equal size, no smaller than MICRO_BATCH_ROWS unless the batch is, on the pool's workers if there
+// is one. The slices' weight and bias gradients are then summed pairwise up a binary tree in a fixed
+// order (slice m absorbs slice m+stride) into replicas[0].workspace, and their output stats into
+// `into`, one per member. Neither the slices nor the order depend on the thread count. Every
+// workspace is its own 64-byte aligned arena, so workers never share a cache line. A batch that
+// makes a single slice is run in place instead, on the network's own buffers and workspace, which
+// computes exactly what its one replica would. Returns the workspace holding the gradients.
+Workspace& Network::micro_step(OutputStats* into)
 {
-  FILE* rptr = fopen(path, "r");
-  char line[MAXLINE];
-  std::vector<std::string> lines;
-  int count = 0;
-  while (fgets(line, MAXLINE, rptr) != NULL) {
-    lines.emplace_back(line);
-    count++;
+  int used = std::min(micro_batches, (batch_rows + MICRO_BATCH_ROWS - 1) / MICRO_BATCH_ROWS);
+  if (used <= 1) {
+    forward_pass(layers, *labels, &workspace, into, members);
+    compute_gradients(layers, workspace);
+    return workspace;
+  }
+  if (replicas.empty()) build_replicas();
+  int parts = replicas.size();
+  for (int m = 0, offset = 0; m < parts; m++) {
+    replicas[m].rows = m < used ? batch_rows / used + (m < batch_rows % used ? 1 : 0) : 0;
+    replicas[m].offset = offset;
+    offset += replicas[m].rows;
+  }
+  if (pool != nullptr) {
+    pool->run([this, parts](int t) -> void {
+      for (int m = t; m < parts; m += pool->size()) micro_batch(m);
+    });
+  }
+  else for (int m = 0; m < parts; m++) micro_batch(m);
+  for (int k = 0; k < members; k++) {
+    into[k] = OutputStats();
+    for (Replica& replica : replicas) {
+      into[k].loss += replica.stats[k].loss;
+      into[k].correct += replica.stats[k].correct;
+    }
   }
-  lines[lines.size()-1] = lines[lines.size()-1] + "\n";
-  std::random_device rd;
-  std::mt19937 g(rd());
-  std::shuffle(lines.begin(), lines.end(), g);
-  fclose(rptr);
-  FILE* wptr = fopen(out_path, "w");
-  for (std::string & i : lines) {
-    const char* cstr = i.c_str();
-    fprintf(wptr,"%s", cstr);
-  }
-  fclose(wptr);
-  return count;
-}
-
-int split_file(char* path, int lines, float ratio)
-{
-  FILE* src = fopen(path, "r");
-  FILE* test = fopen(TEST_PATH, "w");
-  FILE* train = fopen(TRAIN_PATH, "w");
-  int switch_line = round(ratio * lines);
-  char line[MAXLINE];
-  int tests = 0;
-  for (int i = 0; fgets(line, MAXLINE, src) != NULL; i++) {
-    if (i > switch_line) {
-      fprintf(test, "%s", line);
-      tests++;
+  for (int stride = 1; stride < parts; stride *= 2) {
+    if (pool != nullptr) {
+      pool->run([this, stride](int t) -> void {
+        for (int m = 2*stride*t; m+stride < (int) replicas.size(); m += 2*stride*pool->size()) {
+          absorb(replicas[m], replicas[m+stride]);
+        }
+      });
     }
-    else fprintf(train, "%s", line);
-  }
-  fclose(src);
-  fclose(test);
-  fclose(train);
-  return tests;
-}
-
-float Network::test(char* path)
-{
-  FILE* test_data = fopen(path, "r");
-  float costsum = 0;
-  float accsum = 0;
-  for (int i = 0; i <= test_instances-batch_size; i+=batch_size) {
-    char line[MAXLINE];
-    int inputs = layers[0].contents->cols();
-    int datalen = batch_size * inputs;
-    float batch[datalen];
-    int label = -1;
-    for (int i = 0; i < batch_size; i++) {
-      fgets(line, MAXLINE, test_data);
-      //if (strcmp(line, "\n")==0) continue;
-      char *p;
-      p = strtok(line,",");
-      for (int j = 0; j < inputs; j++) {
-        batch[j + (i * inputs)] = strtod(p, NULL);
-        p = strtok(NULL,",");
+    else for (int m = 0; m+stride < parts; m += 2*stride) absorb(replicas[m], replicas[m+stride]);
+  }
+  return replicas[0].workspace;
+}
+
+// Forward and backward pass of one micro-batch, on its rows of the network's batch.
+void Network::micro_batch(int part)
+{
+  Replica& replica = replicas[part];
+  for (OutputStats& stats : replica.stats) stats = OutputStats();
+  if (replica.rows == 0) return;
+  set_batch_rows(replica.layers, replica.workspace, replica.rows);
+  replica.layers[0].batch().noalias() = layers[0].batch().middleRows(replica.offset, replica.rows);
+  replica.labels->topRows(replica.rows) = labels->middleRows(replica.offset, replica.rows);
+  forward_pass(replica.layers, *replica.labels, &replica.workspace, replica.stats.data(), members);
+  compute_gradients(replica.layers, replica.workspace);
+  layers[length-1].batch().middleRows(replica.offset, replica.rows) = replica.layers[length-1].batch();
+}
+
+// Gathers the given rows of the dataset into an input matrix and its labels. Runs of consecutive
+// rows are copied as one block, which is what chunked shuffling and the validation set produce.
+void Network::load_rows(const int* rows, int n, Eigen::Ref<Eigen::MatrixXf> inputs, Eigen::Ref<Eigen::MatrixXf> targets)
+{
+  for (int i = 0; i < n;) {
+    int run = 1;
+    while (i+run < n && rows[i+run] == rows[i]+run) run++;
+    inputs.middleRows(i, run) = data->features(rows[i], run);
+    targets.col(0).segment(i, run) = data->labels(rows[i], run);
+    i += run;
+  }
+}
+
+// Number of batches filled ahead of training by a background thread. 0 loads batches synchronously.
+void Network::set_prefetch(int depth)
+{
+  delete pipeline;
+  pipeline = nullptr;
+  prefetch_depth = depth;
+}
+
+// Loads the next batch_size rows of the epoch, or what is left of it, and wraps around at the end.
+// While train() has the prefetch thread running, the next batch is already sitting in the ring and
+// only the buffer pointers are swapped into the input layer and labels.
+int Network::next_batch()
+{
+  TRACE("load");
+  if (cursor >= instances) cursor = 0;
+  int n = std::min(batch_size, instances - cursor);
+  use_rows(n);
+  if (pipeline != nullptr && pipeline->running()) {
+    Batch& batch = pipeline->acquire();
+    std::swap(layers[0].contents, batch.inputs);
+    std::swap(labels, batch.labels);
+    pipeline->release();
+  }
+  else load_rows(train_rows.data() + cursor, n, layers[0].batch(), *labels);
+  cursor += n;
+  return 0;
+}
+
+// Scores the current parameters on the whole validation split, including the rows that do not
+// fill a training batch. The split is gathered into the validator once and kept until it changes.
+float Network::test()
+{
+  finish_validation(true);
+  gather_validation();
+  validator->run(params.arena);
+  val_acc = validator->accuracy;
+  val_cost = validator->loss + 0.5f*lambda*weight_norm;
+  validating = -1;
+  return 0;
+}
+
+// Builds the validator and copies the validation split into it, unless that is already done.
+// members is passed on to the Validator, for ensembles.
+void Network::gather_validation(int members)
+{
+  if (validator != nullptr) return;
+  TRACE("load");
+  validator = new Validator (layers, params, validation_batch, members);
+  validator->features.resize(test_instances, layers[0].contents->cols());
+  validator->labels.resize(test_instances, 1);
+  load_rows(test_rows.data(), test_instances, validator->features, validator->labels);
+}
+
+// Rows per forward pass when scoring the validation split (VALIDATION_BATCH by default). With
+// background on, train() hands each epoch's validation to a thread of its own, scoring a copy of
+// the parameters while the next epoch trains; its line is printed, and get_val_acc() and
+// get_val_cost() move on, once it finishes.
+void Network::set_validation(int batch, bool background)
+{
+  drop_validator();
+  validation_batch = batch;
+  background_validation = background;
+}
+
+// Waits for any background validation and frees the cached split, e.g. once the split or the
+// layers change.
+void Network::drop_validator()
+{
+  if (validator == nullptr) return;
+  finish_validation(true);
+  delete validator;
+  validator = nullptr;
+}
+
+// Reports the pending background validation: val_acc and val_cost, and the epoch's line if verbose.
+// Without block it only does so if the job has already finished.
+void Network::finish_validation(bool block)
+{
+  if (validating < 0 || validator == nullptr || (!block && !validator->ready())) return;
+  validator->wait();
+  val_acc = validator->accuracy;
+  val_cost = validator->loss + 0.5f*lambda*validator->squares;
+  if (verbose) printf("Epoch %i complete - cost %f - acc %f - val_cost %f - val_acc %f\n", validating, epoch_cost, epoch_acc, val_cost, val_acc);
+  validating = -1;
+}
+
+// Blocks until the last epoch's validation is in val_acc and val_cost.
+void Network::wait_validation()
+{
+  finish_validation(true);
+}
+
+// One asynchronous epoch. Worker t trains on batches t, t+threads, ... of the shuffled order and
+// keeps its own running cost and accuracy, which are only added together at the end.
+void Network::hogwild_epoch(float& cost_sum, float& acc_sum)
+{
+  int threads = replicas.size();
+  int total = (instances + batch_size - 1) / batch_size;
+  pool->run([this, threads, total](int t) -> void {
+    Replica& replica = replicas[t];
+    std::vector<Layer>& local = replica.layers;
+    replica.cost_sum = 0;
+    replica.acc_sum = 0;
+    for (int k = t; k < total; k += threads) {
+      int n = std::min(batch_size, instances - k*batch_size);
+      set_batch_rows(local, replica.workspace, n);
+      {
+        TRACE("load");
+        load_rows(train_rows.data() + k*batch_size, n, local[0].batch(), *replica.labels);
       }
-      (*labels)(i, 0) = strtod(p, NULL);
+      forward_pass(local, *replica.labels, &replica.workspace, replica.stats.data());
+      compute_gradients(local, replica.workspace);
+      float squares = apply_gradients(replica.workspace, n);
+      replica.cost_sum += replica.stats[0].loss + n * 0.5f*lambda*squares;
+      replica.acc_sum += replica.stats[0].correct;
     }
-    float* batchptr = batch;
-    update_layer(batchptr, datalen, 0);
-    feedforward();
-    costsum += cost();
-    accsum += accuracy();
-  }
-  val_acc = 1.0/((float) test_instances/batch_size) * accsum;
-  val_cost = 1.0/((float) test_instances/batch_size) * costsum;
-  return 0;
+  });
+  weight_norm = squared_weights();
+  for (Replica& replica : replicas) {
+    cost_sum += replica.cost_sum;
+    acc_sum += replica.acc_sum;
+  }
+  batches += total;
 }
 
 void Network::train()
 {
-  rewind(data);
+  TRACE("epoch");
+  shuffle_rows();
+  cursor = 0;
   float cost_sum = 0;
   float acc_sum = 0;
-  for (int i = 0; i <= instances-batch_size; i+=batch_size) {
-    if (i != instances-batch_size) { // Don't try to advance batch on final batch.
-      next_batch();
+  if (asynchronous) hogwild_epoch(cost_sum, acc_sum);
+  else train_epoch(cost_sum, acc_sum);
+  finish_validation(true); // the previous epoch's, which prints its own cost and accuracy
+  epoch_acc = acc_sum / instances;
+  epoch_cost = cost_sum / instances;
+  if (background_validation) {
+    gather_validation();
+    validator->start(params.arena, weight_norm);
+    validating = epochs;
+  }
+  else test();
+  if (verbose && validating < 0) printf("Epoch %i complete - cost %f - acc %f - val_cost %f - val_acc %f\n", epochs, epoch_cost, epoch_acc, val_cost, val_acc);
+  batches=1;
+  cursor = 0;
+  learning_rate = decay(learning_rate, epochs);
+  if (growth_every > 0 && (epochs+1) % growth_every == 0) {
+    set_batch_size(std::min(largest_batch, (int) round(batch_size * batch_growth)));
+  }
+  epochs++;
+}
+
+// Trains for total_epochs epochs on caller-owned arrays: rows x inputs row-major features and one
+// class index per row. They are read in place, so they must stay alive while the network trains on
+// them. The train/validation split is redrawn over the new rows. Call after initialize().
+void Network::fit(const float* features, const float* targets, int rows, int total_epochs)
+{
+  delete borrowed;
+  borrowed = new Dataset (features, targets, rows, layers[0].contents->cols());
+  data = borrowed;
+  dataset_rows = rows;
+  split_rows();
+  for (int i = 0; i < total_epochs; i++) train();
+  finish_validation(true);
+}
+
+// One synchronous epoch (optionally fed by the prefetch thread), every step cut into micro-batches
+// (see micro_step). Every training row is used once; the last batch holds whatever is left over.
+// The sums are over rows, so that batch counts for its size.
+void Network::train_epoch(float& cost_sum, float& acc_sum)
+{
+  int total = (instances + batch_size - 1) / batch_size;
+  if (prefetch_depth > 0) {
+    if (pipeline == nullptr) {
+      pipeline = new BatchPipeline (prefetch_depth, max_batch, layers[0].contents->cols(), labels->cols());
     }
-    feedforward();
-    backpropagate();
-    cost_sum += cost();
-    acc_sum += accuracy();
+    pipeline->start([this](Batch& batch, int k) -> void {
+      TRACE("prefetch");
+      int n = std::min(batch_size, instances - k*batch_size);
+      Eigen::Map<Eigen::MatrixXf> inputs (batch.inputs->data(), n, batch.inputs->cols());
+      load_rows(train_rows.data() + k*batch_size, n, inputs, *batch.labels);
+    }, total);
+  }
+  for (int k = 0; k < total; k++) {
+    next_batch();
+    weight_norm = apply_gradients(micro_step(&stats), batch_rows);
+    cost_sum += batch_rows * cost();
+    acc_sum += batch_rows * accuracy();
     batches++;
     // if (i > batch_size * 10) {
     //   list_net();
     //   exit(1);
     // }
   }
-  epoch_acc = 1.0/((float) instances/batch_size) * acc_sum;
-  epoch_cost = 1.0/((float) instances/batch_size) * cost_sum;
-  test(TEST_PATH);
-  printf("Epoch %i complete - cost %f - acc %f - val_cost %f - val_acc %f\n", epochs, epoch_cost, epoch_acc, val_cost, val_acc);
-  batches=1;
-  rewind(data);
-  learning_rate = decay(learning_rate, epochs);
-  epochs++;
+  if (pipeline != nullptr) pipeline->stop();
 }
 
 float Network::get_acc() {return epoch_acc;}
-float Network::get_val_acc() {return val_acc;}
+float Network::get_val_acc() {finish_validation(false); return val_acc;}
 float Network::get_cost() {return epoch_cost;}
-float Network::get_val_cost() {return val_cost;}
+float Network::get_val_cost() {finish_validation(false); return val_cost;}
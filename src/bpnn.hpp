@@ -3,8 +3,16 @@
 
 #include <Eigen/Dense>
 
+#include "utils.hpp"
+#include "dataset.hpp"
+#include "pipeline.hpp"
+#include "threadpool.hpp"
+#include "optimizer.hpp"
+
 #include "../../mapreduce/mapreduce.hpp"
 
+#include <atomic>
+#include <memory>
 #include <vector>
 #include <array>
 #include <iostream>
@@ -14,28 +22,133 @@
 #include <random>
 #include <algorithm>
 
+// A tensor living inside a network's Parameters.
+typedef Eigen::Map<Eigen::MatrixXf, Eigen::Aligned64> ParamMap;
+
 class Layer {
 public:
   Eigen::MatrixXf* contents;
-  Eigen::MatrixXf* weights;
-  Eigen::MatrixXf* v;
-  Eigen::MatrixXf* bias;
+  ParamMap* weights = nullptr;
+  ParamMap* v = nullptr; // first-moment (velocity) state of the optimizer for weights
+  ParamMap* s = nullptr; // second-moment state, for the optimizers that keep one
+  ParamMap* bias = nullptr;
+  ParamMap* bias_v = nullptr;
+  ParamMap* bias_s = nullptr;
   Eigen::MatrixXf* dZ;
+  int rows; // rows in the current batch; contents and dZ have room for the largest
   std::vector<Eigen::MatrixXf> prev_updates;
   std::function<float(float)> activation;
   std::function<float(float)> activation_deriv;
+  Activation activation_kind = Activation::Custom;
   char activation_str[1024];
   
   Layer(int rows, int columns);
   Layer(float* vals, int rows, int columns);
-  void init_weights(Layer next);
+  void init_weights(Layer next, std::mt19937& gen);
+  Eigen::Map<Eigen::MatrixXf> batch();
+  Eigen::Map<Eigen::MatrixXf> batch_dZ();
+  void activate();
+  void activate(int col, int n);
+  void forward(Eigen::Ref<const Eigen::MatrixXf> input, Eigen::Ref<const Eigen::MatrixXf> w, int index = -1); // index only labels trace events
+};
+
+// Every weight matrix and bias of a network in one 64-byte aligned allocation, planned by
+// Network::initialize(): all the weights back to back, then all the biases, each tensor padded to
+// a whole cache line. The optimizer's v (and s, if it keeps one) mirror that layout in the same
+// allocation, and Workspace lays out its gradients the same way, so an element sits at the same
+// offset in each. The layers' tensors are views into it, while whole-model work (the update, the
+// L2 norm, reducing gradients, resetting the optimizer, checksums) is one pass over a flat vector.
+class Parameters {
+public:
+  float* arena = nullptr;
+  Eigen::Index size = 0; // floats per mirror, padding included
+  Eigen::Index biases = 0; // offset of the first bias (layer 0's)
+  Eigen::Index trained_biases = 0; // offset of layer 1's bias, where the biases Network trains begin
+  int mirrors = 0; // values, v and possibly s
+  size_t mapped = 0; // length of the mapping if arena is a fork's copy-on-write view of a Snapshot
+  std::vector<ParamMap> views; // what the layers point to
+
+  void plan(std::vector<Layer>& layers, bool second_moment);
+  void place(std::vector<Layer>& layers);
+  void release();
+  Eigen::Map<Eigen::VectorXf, Eigen::Aligned64> flat(int mirror = 0); // 0 values, 1 v, 2 s
+  uint64_t checksum() const;
+};
+
+// Offsets of every tensor in the shared layout of Parameters and the workspace gradients.
+Eigen::Index parameter_layout(const std::vector<Layer>& layers, std::vector<Eigen::Index>& weights,
+                              std::vector<Eigen::Index>& biases);
+
+// Every buffer backpropagation needs, carved out of one 64-byte aligned allocation planned by
+// Network::initialize() so a training step never touches the heap. Index k walks from the
+// output layer backwards, in the same order backpropagate visits the layers. The weight and bias
+// gradients form one block with the layout of Parameters.
+class Workspace {
+public:
+  float* arena = nullptr;
+  std::vector<Eigen::Map<Eigen::MatrixXf>> gradients; // error at layer length-1-k
+  std::vector<Eigen::Map<Eigen::MatrixXf>> deltas; // gradient of the weights feeding layer length-1-k
+  std::vector<Eigen::Map<Eigen::RowVectorXf>> bias_grads; // gradient of the bias of layer length-1-k
+  float* grads = nullptr; // deltas and bias_grads, laid out like Parameters
+  Eigen::Index grads_size = 0;
+  int rows = 0; // rows the gradients currently span, up to the batch_size planned for
+
+  void plan(std::vector<Layer>& layers, int batch_size);
+  void use_rows(int n);
+  Eigen::Map<Eigen::VectorXf, Eigen::Aligned64> flat_grads();
 };
 
+// What the fused output pass found on the rows of a batch.
+struct OutputStats {
+  float loss = 0; // summed cross-entropy
+  float correct = 0; // rows whose largest output is their label
+};
+
+// One micro-batch of a synchronous step, or one Hogwild worker: its own activations, derivatives,
+// labels and workspace, with weights and biases aliased from the network it was cut from.
+struct Replica {
+  std::vector<Layer> layers;
+  Eigen::MatrixXf* labels;
+  Workspace workspace;
+  std::vector<OutputStats> stats; // one per member
+  int offset;
+  int rows;
+  float cost_sum;
+  float acc_sum;
+};
+
+void forward_pass(std::vector<Layer>& layers, const Eigen::MatrixXf& labels, Workspace* workspace, OutputStats* stats, int members = 1);
+void compute_gradients(std::vector<Layer>& layers, Workspace& workspace);
+void set_batch_rows(std::vector<Layer>& layers, Workspace& workspace, int rows);
+
+class Validator;
+class Snapshot;
+class CompiledModel;
+#define VALIDATION_BATCH 1024 // rows per forward pass when scoring the validation split
+#define MICRO_BATCHES 8 // most pieces a training batch is cut into, whatever the thread count
+#define MICRO_BATCH_ROWS 32 // fewest rows worth a piece of their own
+
 class Network {
 public:
-  FILE* data;
+  Dataset* data;
+  Dataset* opened = nullptr; // opened from a path by the constructor, so freed with the network
+  Dataset* borrowed = nullptr; // wraps the arrays last passed to fit()
+  int dataset_rows = 0; // rows split between training and validation
+  std::vector<int> train_rows; // indices into data, reshuffled every epoch
+  std::vector<int> test_rows;
+  int cursor = 0;
   int instances;
   int test_instances;
+  float ratio;
+  int shuffle_chunk = 0;
+  std::mt19937 rng;
+  int prefetch_depth = 0;
+  BatchPipeline* pipeline = nullptr;
+  ThreadPool* pool = nullptr;
+  std::vector<Replica> replicas; // built by the first step that needs more than one slice, or by set_async
+  int micro_batches = MICRO_BATCHES;
+  bool asynchronous = false;
+  int members = 1; // models side by side in the output layer (see Ensemble)
 
   std::vector<Layer> layers;
   int length = 0;
@@ -44,45 +157,109 @@ public:
   float epoch_cost;
   float val_acc;
   float val_cost;
+  Validator* validator = nullptr;
+  int validation_batch = VALIDATION_BATCH;
+  bool background_validation = false;
+  int validating = -1; // epoch whose background validation has not been reported yet
   
   float learning_rate;
   float bias_lr;
   float lambda;
   int batch_size;
+  int max_batch; // rows every batch buffer is allocated for
+  int batch_rows; // rows in the current batch: batch_size, or fewer for the last batch of an epoch
+  float batch_growth = 1; // see set_batch_schedule
+  int growth_every = 0;
+  int largest_batch = 0;
 
   int epochs = 0;
   int batches = 0;
-  Eigen::MatrixXf* labels;
+  Eigen::MatrixXf* labels = nullptr;
+  Workspace workspace;
+  Parameters params;
+  OutputStats stats; // of the last batch fed forward
+  float weight_norm = 0; // sum of the squared weights, kept current by every update
 
   std::function<float(float, float)> decay;
+  char decay_type[8] = "none"; // what init_decay was last called with, for checkpoints
+  float decay_a0 = 0;
+  float decay_k = 0;
+  OptimizerConfig optimizer;
+  std::atomic<long> steps {0}; // updates applied since the optimizer was last reset; Hogwild workers add to it at once
+  std::shared_ptr<CompiledModel> compiled; // kept by the Python predict between calls
+  long compiled_steps = -1; // steps when compiled was built
+
+  bool verbose = true;
 
   Network(char* path, int batch_sz, float learn_rate, float bias_rate, float l, float ratio);
+  Network(Dataset* dataset, int batch_sz, float learn_rate, float bias_rate, float l, float ratio);
+  Network(int batch_sz, float learn_rate, float bias_rate, float l, float ratio);
+  virtual ~Network();
+  Network(const Network&) = delete; // see fork()
+  Network& operator=(const Network&) = delete;
   void add_layer(int nodes, char* activation);
   void init_decay(char* type, float a_0, float k);
+  void init_optimizer(char* type, float beta1, float beta2, float epsilon);
+  void reset_optimizer();
   void initialize();
+  void set_batch_size(int rows);
+  void set_batch_schedule(float factor, int every, int largest);
+  void reserve_batch(int capacity);
+  void use_rows(int n);
   void update_layer(float* vals, int datalen, int index);
   void set_activation(int index, std::function<float(float)> custom, std::function<float(float)> custom_deriv);
+  void seed(unsigned int s);
+  void set_shuffle(int chunk);
+  void split_rows();
+  void shuffle_rows();
+  void load_rows(const int* rows, int n, Eigen::Ref<Eigen::MatrixXf> inputs, Eigen::Ref<Eigen::MatrixXf> targets);
+  void set_prefetch(int depth);
+  void set_threads(int threads);
+  void set_async(int threads);
+  void set_micro_batches(int parts);
+  void build_replicas();
+  void free_replicas();
+  float apply_gradients(Workspace& ws, int rows);
+  float squared_weights();
+  uint64_t checksum();
+  Snapshot* snapshot();
+  Network* fork(const Snapshot& from);
+  Network* fork();
+  Workspace& micro_step(OutputStats* into);
+  void micro_batch(int part);
   
   void feedforward();
   void list_net();
 
   float cost();
+  float cost(Eigen::Ref<Eigen::MatrixXf> out, Eigen::Ref<Eigen::MatrixXf> targets);
+  float cross_entropy(Eigen::Ref<Eigen::MatrixXf> out, Eigen::Ref<Eigen::MatrixXf> targets);
   float accuracy();
+  float accuracy(Eigen::Ref<Eigen::MatrixXf> out, Eigen::Ref<Eigen::MatrixXf> targets);
   void backpropagate();
   int next_batch();
-  float test(char* path);
+  float test();
+  void gather_validation(int members = 1);
+  void set_validation(int batch, bool background);
+  void drop_validator();
+  void finish_validation(bool block);
+  void wait_validation();
   void train();
+  void fit(const float* features, const float* targets, int rows, int total_epochs);
+  void train_epoch(float& cost_sum, float& acc_sum);
+  void hogwild_epoch(float& cost_sum, float& acc_sum);
 
   float get_acc();
   float get_cost();
   float get_val_acc();
   float get_val_cost();
+
+private:
+  Network(const Network& parent, const Snapshot& from);
 };
 
-void checks(Network net);
+void checks(Network& net);
 void demo(int total_epochs);
-int prep_file(char* path, char* out_path);
-int split_file(char* path, int lines, float ratio);
 
 struct ValueError : public std::exception
 {
@@ -101,6 +278,7 @@ struct ValueError : public std::exception
 };
 
 #define MAXLINE 1024
+#define FORWARD_BLOCK 32768 // floats per column block in Layer::forward, sized for L2
 #define ZERO_THRESHOLD pow(10, -8) // for checks
 
 #if (!RECKLESS)
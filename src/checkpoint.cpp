@@ -0,0 +1,247 @@
+#include "checkpoint.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <typeinfo>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static_assert(sizeof(CheckpointHeader) == 128, "CheckpointHeader must stay 128 bytes");
+static_assert(sizeof(CheckpointLayer) == 64, "CheckpointLayer must stay 64 bytes");
+
+static size_t aligned(size_t offset)
+{
+  return (offset + CHECKPOINT_ALIGN - 1) / CHECKPOINT_ALIGN * CHECKPOINT_ALIGN;
+}
+
+// Appends `bytes` bytes (zeros if data is null) at the next aligned offset.
+static void write_aligned(FILE* f, const void* data, size_t bytes, size_t& offset)
+{
+  static const char zeros[CHECKPOINT_ALIGN] = {0};
+  size_t start = aligned(offset);
+  fwrite(zeros, 1, start - offset, f);
+  if (data != nullptr) fwrite(data, 1, bytes, f);
+  else for (size_t i = 0; i < bytes; i += CHECKPOINT_ALIGN) fwrite(zeros, 1, std::min<size_t>(CHECKPOINT_ALIGN, bytes - i), f);
+  offset = start + bytes;
+}
+
+static void write_tensor(FILE* f, const ParamMap* m, size_t n, size_t& offset)
+{
+  write_aligned(f, m != nullptr ? m->data() : nullptr, n * sizeof(float), offset);
+}
+
+// Writes everything needed to resume training bit for bit, or to serve the model: topology,
+// activation names, parameters, optimizer state, epoch and step counters, learning rate and batch
+// size schedules, the train/validation split and the RNG. The file is written under a temporary name and renamed
+// into place, so a reader never maps a half-written checkpoint. Custom activations are saved under
+// the name their layer was added with and have to be set again after loading. Names are limited to
+// 59 characters. Only a plain Network can be saved; the subclasses hold state the format has no room for.
+void save_checkpoint(Network& net, const char* path)
+{
+  if (typeid(net) != typeid(Network)) throw std::runtime_error("Only a plain Network can be checkpointed!");
+  bool second = second_moment(net.optimizer.kind);
+  std::ostringstream rng;
+  rng << net.rng;
+  std::string state = rng.str();
+
+  CheckpointHeader header = {};
+  memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+  header.version = CHECKPOINT_VERSION;
+  header.layers = net.length;
+  header.batch_size = net.batch_size;
+  header.optimizer = (uint32_t) net.optimizer.kind;
+  header.epochs = net.epochs;
+  header.train_rows = net.train_rows.size();
+  header.test_rows = net.test_rows.size();
+  header.rng_bytes = state.size();
+  header.shuffle_chunk = net.shuffle_chunk;
+  header.steps = net.steps;
+  header.learning_rate = net.learning_rate;
+  header.bias_lr = net.bias_lr;
+  header.lambda = net.lambda;
+  header.ratio = net.ratio;
+  header.beta1 = net.optimizer.beta1;
+  header.beta2 = net.optimizer.beta2;
+  header.epsilon = net.optimizer.epsilon;
+  header.decay_a0 = net.decay_a0;
+  header.decay_k = net.decay_k;
+  snprintf(header.decay, sizeof(header.decay), "%s", net.decay_type);
+  header.batch_growth = net.batch_growth;
+  header.growth_every = net.growth_every;
+  header.largest_batch = net.largest_batch;
+  header.max_batch = net.max_batch;
+  for (int i = 0; i < net.length; i++) {
+    if (strlen(net.layers[i].activation_str) >= sizeof(CheckpointLayer::activation)) {
+      throw std::invalid_argument("Activation names longer than " + std::to_string(sizeof(CheckpointLayer::activation)-1)
+                                  + " characters cannot be saved in a checkpoint");
+    }
+  }
+
+  std::string tmp = std::string(path) + "." + std::to_string(getpid()) + ".tmp";
+  FILE* f = fopen(tmp.c_str(), "wb");
+  if (f == NULL) throw std::runtime_error(std::string("Unable to write checkpoint `") + path + "`!");
+  fwrite(&header, sizeof(header), 1, f);
+  for (int i = 0; i < net.length; i++) {
+    CheckpointLayer layer = {};
+    layer.nodes = net.layers[i].contents->cols();
+    snprintf(layer.activation, sizeof(layer.activation), "%.*s", (int)sizeof(layer.activation)-1, net.layers[i].activation_str);
+    fwrite(&layer, sizeof(layer), 1, f);
+  }
+  size_t offset = sizeof(CheckpointHeader) + net.length * sizeof(CheckpointLayer);
+  for (int i = 0; i < net.length; i++) {
+    Layer& layer = net.layers[i];
+    size_t nodes = layer.contents->cols();
+    write_tensor(f, layer.bias, nodes, offset);
+    write_tensor(f, layer.bias_v, nodes, offset);
+    if (second) write_tensor(f, layer.bias_s, nodes, offset);
+    if (i < net.length-1) {
+      size_t n = layer.weights->size();
+      write_tensor(f, layer.weights, n, offset);
+      write_tensor(f, layer.v, n, offset);
+      if (second) write_tensor(f, layer.s, n, offset);
+    }
+  }
+  write_aligned(f, net.train_rows.data(), net.train_rows.size() * sizeof(int32_t), offset);
+  write_aligned(f, net.test_rows.data(), net.test_rows.size() * sizeof(int32_t), offset);
+  write_aligned(f, state.data(), state.size(), offset);
+  bool failed = ferror(f);
+  failed |= fclose(f) != 0;
+  if (failed || rename(tmp.c_str(), path) != 0) {
+    unlink(tmp.c_str());
+    throw std::runtime_error(std::string("Unable to write checkpoint `") + path + "`!");
+  }
+}
+
+Checkpoint::Checkpoint(const char* path)
+{
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) throw std::runtime_error(std::string("Unable to open checkpoint `") + path + "`!");
+  struct stat info;
+  fstat(fd, &info);
+  length = info.st_size;
+  if (length < sizeof(CheckpointHeader)) {
+    close(fd);
+    throw std::runtime_error(std::string("Truncated checkpoint `") + path + "`!");
+  }
+  mapping = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) throw std::runtime_error(std::string("Unable to map checkpoint `") + path + "`!");
+
+  const char* base = (const char*) mapping;
+  header = (const CheckpointHeader*) base;
+  if (memcmp(header->magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) != 0 || header->version != CHECKPOINT_VERSION) {
+    munmap(mapping, length);
+    throw std::runtime_error(std::string("Invalid checkpoint `") + path + "`!");
+  }
+  bool second = second_moment((Optimizer) header->optimizer);
+  size_t offset = sizeof(CheckpointHeader) + header->layers * sizeof(CheckpointLayer);
+  bool truncated = offset > length;
+  auto take = [&](size_t bytes) -> const char* {
+    offset = aligned(offset);
+    const char* p = base + offset;
+    offset += bytes;
+    truncated |= offset > length;
+    return p;
+  };
+  layers = (const CheckpointLayer*) (base + sizeof(CheckpointHeader));
+  for (uint32_t i = 0; !truncated && i < header->layers; i++) {
+    size_t nodes = layers[i].nodes;
+    biases.push_back((const float*) take(nodes * sizeof(float)));
+    bias_v.push_back((const float*) take(nodes * sizeof(float)));
+    bias_s.push_back(second ? (const float*) take(nodes * sizeof(float)) : nullptr);
+    if (i < header->layers-1) {
+      size_t n = nodes * layers[i+1].nodes;
+      weights.push_back((const float*) take(n * sizeof(float)));
+      v.push_back((const float*) take(n * sizeof(float)));
+      s.push_back(second ? (const float*) take(n * sizeof(float)) : nullptr);
+    }
+  }
+  train_rows = (const int32_t*) take(header->train_rows * sizeof(int32_t));
+  test_rows = (const int32_t*) take(header->test_rows * sizeof(int32_t));
+  rng = take(header->rng_bytes);
+  if (truncated) {
+    munmap(mapping, length);
+    throw std::runtime_error(std::string("Truncated checkpoint `") + path + "`!");
+  }
+}
+
+Checkpoint::~Checkpoint()
+{
+  munmap(mapping, length);
+}
+
+static void copy_tensor(const float* from, ParamMap* to)
+{
+  if (from != nullptr && to != nullptr) std::copy(from, from + to->size(), to->data());
+}
+
+// Rebuilds the network from a checkpoint: topology, hyperparameters, parameters, optimizer state,
+// counters, split and RNG. The network keeps its data source, which must be the dataset the
+// checkpoint was trained on. Replicas and the prefetch ring are rebuilt for the new layers.
+void load_checkpoint(Network& net, const char* path)
+{
+  if (typeid(net) != typeid(Network)) throw std::runtime_error("Only a plain Network can be checkpointed!");
+  Checkpoint checkpoint (path);
+  const CheckpointHeader& h = *checkpoint.header;
+  if (net.data != nullptr && (int)(h.train_rows + h.test_rows) != net.dataset_rows) {
+    throw std::runtime_error(std::string("Checkpoint `") + path + "` was taken on a different dataset!");
+  }
+  net.batch_size = h.batch_size;
+  net.max_batch = std::max(h.max_batch, h.batch_size);
+  net.batch_growth = h.batch_growth;
+  net.growth_every = h.growth_every;
+  net.largest_batch = h.largest_batch;
+  for (Layer& layer : net.layers) {
+    delete layer.contents;
+    delete layer.dZ;
+  }
+  net.layers.clear();
+  net.length = 0;
+  for (uint32_t i = 0; i < h.layers; i++) {
+    char name[sizeof(CheckpointLayer::activation)];
+    snprintf(name, sizeof(name), "%.*s", (int)sizeof(name)-1, checkpoint.layers[i].activation);
+    net.add_layer(checkpoint.layers[i].nodes, name);
+  }
+  net.optimizer.kind = (Optimizer) h.optimizer;
+  net.optimizer.beta1 = h.beta1;
+  net.optimizer.beta2 = h.beta2;
+  net.optimizer.epsilon = h.epsilon;
+  net.initialize();
+  for (int i = 0; i < net.length; i++) {
+    Layer& layer = net.layers[i];
+    copy_tensor(checkpoint.biases[i], layer.bias);
+    copy_tensor(checkpoint.bias_v[i], layer.bias_v);
+    copy_tensor(checkpoint.bias_s[i], layer.bias_s);
+    if (i < net.length-1) {
+      copy_tensor(checkpoint.weights[i], layer.weights);
+      copy_tensor(checkpoint.v[i], layer.v);
+      copy_tensor(checkpoint.s[i], layer.s);
+    }
+  }
+  net.weight_norm = net.squared_weights();
+  net.learning_rate = h.learning_rate;
+  net.bias_lr = h.bias_lr;
+  net.lambda = h.lambda;
+  net.ratio = h.ratio;
+  net.shuffle_chunk = h.shuffle_chunk;
+  net.epochs = h.epochs;
+  net.steps = h.steps;
+  if (strcmp(h.decay, "none") != 0) {
+    char type[sizeof(h.decay)];
+    snprintf(type, sizeof(type), "%.*s", (int)sizeof(type)-1, h.decay);
+    net.init_decay(type, h.decay_a0, h.decay_k);
+  }
+  net.train_rows.assign(checkpoint.train_rows, checkpoint.train_rows + h.train_rows);
+  net.test_rows.assign(checkpoint.test_rows, checkpoint.test_rows + h.test_rows);
+  net.instances = h.train_rows;
+  net.test_instances = h.test_rows;
+  std::istringstream rng (std::string(checkpoint.rng, h.rng_bytes));
+  rng >> net.rng;
+  net.set_prefetch(net.prefetch_depth);
+  if (!net.replicas.empty()) net.build_replicas();
+}
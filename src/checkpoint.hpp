@@ -0,0 +1,82 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "bpnn.hpp"
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+#define CHECKPOINT_MAGIC "JCBCKPT"
+#define CHECKPOINT_VERSION 2
+#define CHECKPOINT_ALIGN 64
+
+// Header of a checkpoint file, padded to 128 bytes. It is followed by one CheckpointLayer per
+// layer, then the tensors, each starting on a CHECKPOINT_ALIGN boundary:
+//   for every layer i: bias, bias_v, then bias_s if the optimizer keeps second moments;
+//   for every layer i but the last: weights, v, then s if the optimizer keeps second moments;
+// all stored column-major exactly as in memory. They are followed by the training and validation
+// row indices (int32) and the RNG state as text. Values are in the writer's native byte order.
+struct CheckpointHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t layers;
+  uint32_t batch_size;
+  uint32_t optimizer;
+  uint32_t epochs;
+  uint32_t train_rows;
+  uint32_t test_rows;
+  uint32_t rng_bytes;
+  int32_t shuffle_chunk;
+  uint32_t reserved;
+  uint64_t steps;
+  float learning_rate;
+  float bias_lr;
+  float lambda;
+  float ratio;
+  float beta1;
+  float beta2;
+  float epsilon;
+  float decay_a0;
+  float decay_k;
+  char decay[8];
+  float batch_growth;
+  int32_t growth_every;
+  int32_t largest_batch;
+  uint32_t max_batch;
+  char padding[12];
+};
+
+struct CheckpointLayer {
+  uint32_t nodes;
+  char activation[60];
+};
+
+// A checkpoint file mapped read-only. Every pointer points straight into the mapping, so several
+// processes opening the same file share its pages.
+class Checkpoint {
+public:
+  const CheckpointHeader* header;
+  const CheckpointLayer* layers;
+  std::vector<const float*> biases;
+  std::vector<const float*> bias_v;
+  std::vector<const float*> bias_s; // null without second moments
+  std::vector<const float*> weights; // weights[i] feeds layer i+1
+  std::vector<const float*> v;
+  std::vector<const float*> s; // null without second moments
+  const int32_t* train_rows;
+  const int32_t* test_rows;
+  const char* rng;
+
+  Checkpoint(const char* path);
+  ~Checkpoint();
+
+private:
+  void* mapping;
+  size_t length;
+};
+
+void save_checkpoint(Network& net, const char* path);
+void load_checkpoint(Network& net, const char* path);
+
+#endif /* CHECKPOINT_H */
@@ -1,6 +1,5 @@
-void checks(Network net)
+void checks(Network& net)
 {
-  Network original = net;
   int sanity_passed = 0;
   std::cout << "\u001b[4m\u001b[1mSANITY CHECKS:\u001b[0m\n";
   // Check if regularization strength increases loss (as it should).
@@ -8,14 +7,14 @@ void checks(Network net)
 
   //  list_net();
   
-  Network copy1 = net;
-  Network copy2 = net;
-  copy1.lambda += 1;
-  copy1.next_batch();
-  copy1.feedforward();
-  copy2.next_batch();
-  copy2.feedforward();
-  if (copy1.cost() > copy2.cost()) {
+  std::unique_ptr<Network> copy1 (net.fork());
+  std::unique_ptr<Network> copy2 (net.fork());
+  copy1->lambda += 1;
+  copy1->next_batch();
+  copy1->feedforward();
+  copy2->next_batch();
+  copy2->feedforward();
+  if (copy1->cost() > copy2->cost()) {
     std::cout << " \u001b[32mPassed!\n\u001b[37m";
     sanity_passed++;
   }
@@ -25,14 +24,14 @@ void checks(Network net)
   
   // Check if zero cost is achievable on a batch
   std::cout << "Zero-cost sanity check...";
-  copy1 = net;
-  copy1.lambda = 0;
-  copy1.next_batch();
+  copy1.reset(net.fork());
+  copy1->lambda = 0;
+  copy1->next_batch();
   float finalcost;
   for (int i = 0; i < 10000; i++) {
-    copy1.feedforward();
-    copy1.backpropagate();
-    finalcost = copy1.cost();
+    copy1->feedforward();
+    copy1->backpropagate();
+    finalcost = copy1->cost();
     if (finalcost <= ZERO_THRESHOLD) {
       break;
     }
@@ -46,18 +45,18 @@ void checks(Network net)
   //  list_net();
   
   std::cout << "Gradient floating-point sanity check...";
-  copy1 = net;
-  copy1.next_batch();
-  copy1.feedforward();
+  copy1.reset(net.fork());
+  copy1->next_batch();
+  copy1->feedforward();
   std::vector<Eigen::MatrixXf> gradients;
   std::vector<Eigen::MatrixXf> deltas;
-  Eigen::MatrixXf error = ((*copy1.layers[copy1.length-1].contents) - (*copy1.labels));
-  gradients.push_back(error.cwiseProduct(*copy1.layers[copy1.length-1].dZ));
-  deltas.push_back((*copy1.layers[copy1.length-2].contents).transpose() * gradients[0]);
+  Eigen::MatrixXf error = ((*copy1->layers[copy1->length-1].contents) - (*copy1->labels));
+  gradients.push_back(error.cwiseProduct(*copy1->layers[copy1->length-1].dZ));
+  deltas.push_back((*copy1->layers[copy1->length-2].contents).transpose() * gradients[0]);
   int counter = 1;
-  for (int i = copy1.length-2; i >= 1; i--) {
-    gradients.push_back((gradients[counter-1] * copy1.layers[i].weights->transpose()).cwiseProduct(*copy1.layers[i].dZ));
-    deltas.push_back(copy1.layers[i-1].contents->transpose() * gradients[counter]);
+  for (int i = copy1->length-2; i >= 1; i--) {
+    gradients.push_back((gradients[counter-1] * copy1->layers[i].weights->transpose()).cwiseProduct(*copy1->layers[i].dZ));
+    deltas.push_back(copy1->layers[i-1].contents->transpose() * gradients[counter]);
     counter++;
   }
   auto check_gradients = [](std::vector<Eigen::MatrixXf> vec) -> bool {
@@ -80,10 +79,10 @@ void checks(Network net)
   //  list_net();
   
   std::cout << "Expected loss sanity check...";
-  copy1 = net;
-  copy1.next_batch();
-  copy1.feedforward();
-  if (copy1.cost() <= 1) {
+  copy1.reset(net.fork());
+  copy1->next_batch();
+  copy1->feedforward();
+  if (copy1->cost() <= 1) {
     std::cout << " \u001b[32mPassed!\n\u001b[37m";
     sanity_passed++;
   }
@@ -92,28 +91,28 @@ void checks(Network net)
   //  list_net();
   
   std::cout << "Layer updates sanity check...";
-  copy1 = net;
-  copy2 = net;
-  copy1.next_batch();
-  copy1.feedforward();
-  copy2.next_batch();
-  copy2.feedforward();
-  copy1.backpropagate();
+  copy1.reset(net.fork());
+  copy2.reset(net.fork());
+  copy1->next_batch();
+  copy1->feedforward();
+  copy2->next_batch();
+  copy2->feedforward();
+  copy1->backpropagate();
   int passed = 1;
   //list_net();
-  //copy2.list_net();
-  //copy1.list_net();
-  for (int i = 0; i < copy1.layers.size()-1; i++) {
-    if (*copy1.layers[i].weights == *copy2.layers[i].weights) {
-      //      std::cout << *copy2.layers[i].weights <<"uninitweight\n\n";
-      //      std::cout << *copy1.layers[i].weights << " "<<i<<"weight\n\n";
+  //copy2->list_net();
+  //copy1->list_net();
+  for (int i = 0; i < copy1->layers.size()-1; i++) {
+    if (*copy1->layers[i].weights == *copy2->layers[i].weights) {
+      //      std::cout << *copy2->layers[i].weights <<"uninitweight\n\n";
+      //      std::cout << *copy1->layers[i].weights << " "<<i<<"weight\n\n";
       passed = -1;
     }
   }
-  for (int i = 1; i < copy1.layers.size(); i++) {
-    if (*copy1.layers[i].bias == *copy2.layers[i].bias) {
-      //      std::cout << *copy2.layers[i].bias <<"uninitbias\n\n";
-      //  std::cout << *copy1.layers[i].bias <<" " << i << "bias\n\n";
+  for (int i = 1; i < copy1->layers.size(); i++) {
+    if (*copy1->layers[i].bias == *copy2->layers[i].bias) {
+      //      std::cout << *copy2->layers[i].bias <<"uninitbias\n\n";
+      //  std::cout << *copy1->layers[i].bias <<" " << i << "bias\n\n";
       passed = -1;
     }
   }
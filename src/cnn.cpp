@@ -219,11 +219,19 @@ void ConvNet::add_pool_layer(int x, int y, int stride, int kern_x, int kern_y, i
   pool_layers.emplace_back(x,y,stride,kern_x,kern_y,pad);
 }
 
+// As Network::initialize, except that the labels (one class index per image) were already made
+// by the constructor.
 void ConvNet::initialize()
 {
+  params.plan(layers, second_moment(optimizer.kind));
   for (int i = 0; i < length-1; i++) {
-    layers[i].init_weights(layers[i+1]);
+    layers[i].init_weights(layers[i+1], rng);
   }
+  workspace.plan(layers, max_batch);
+  use_rows(batch_size);
+  reset_optimizer();
+  weight_norm = squared_weights();
+  drop_validator();
 }
 
 void ConvNet::next_batch()
@@ -275,51 +283,38 @@ void ConvNet::list_net()
 
 void ConvNet::backpropagate()
 {
-  std::vector<Eigen::MatrixXf> gradients;
-  std::vector<Eigen::MatrixXf> deltas;
-  Eigen::MatrixXf error (layers[length-1].contents->rows(), layers[length-1].contents->cols());
-  // std::cout << (*layers[length-1].contents) << "\n\n\n";
-  for (int i = 0; i < error.rows(); i++) {
-    for (int j = 0; j < error.cols(); j++) {
-      float truth;
-      if (j==(*labels)(i,0)) truth = 1;
-      else truth = 0;
-      error(i,j) = (*layers[length-1].contents)(i,j) - truth;
-      //      std::cout << error(i, j) << " " << (*layers[length-1].contents)(i,j) << " " << truth << "\n";
-      checknan(error(i, j), "gradient of final layer");
-      // std::cout << truth << "[as label is "<< (*labels)(i,0) <<"] - " << (*layers[length-1].contents)(i,j) << "[aka index " << i << " " << j << "] = " << error(i,j) << "\n";
-    }
+  std::vector<Eigen::Map<Eigen::MatrixXf>>& gradients = workspace.gradients;
+  std::vector<Eigen::Map<Eigen::MatrixXf>>& deltas = workspace.deltas;
+  gradients[0] = *layers[length-1].contents;
+  for (int i = 0; i < gradients[0].rows(); i++) {
+    gradients[0](i, (int)(*labels)(i,0)) -= 1;
   }
-  gradients.push_back(error);
-  deltas.push_back((*layers[length-2].contents).transpose() * gradients[0]);
+  checknan(gradients[0].sum(), "gradient of final layer");
+  deltas[0].noalias() = layers[length-2].contents->transpose() * gradients[0];
   int counter = 1;
   for (int i = length-2; i >= 1; i--) {
-    //std::cout << "--GRAD---\n" << gradients[counter-1] << "\n\n" << layers[i].weights->transpose() << "\n\n" << *layers[i].dZ << "\n\n";
-    gradients.push_back((gradients[counter-1] * layers[i].weights->transpose()).cwiseProduct(*layers[i].dZ));
-    //std::cout << "---DELTA---\n" << gradients[counter] << "\n\n" << layers[i].weights->transpose() << "\n\n" << *layers[i].dZ << "\n\n";
-    deltas.push_back(layers[i-1].contents->transpose() * gradients[counter]);
+    gradients[counter].noalias() = gradients[counter-1] * layers[i].weights->transpose();
+    gradients[counter].array() *= layers[i].dZ->array();
+    deltas[counter].noalias() = layers[i-1].contents->transpose() * gradients[counter];
     counter++;
   }
-  gradients.push_back((gradients[gradients.size()-1] * layers[0].weights->transpose()).cwiseProduct(*layers[0].dZ));
+  // The workspace keeps one extra gradient for the input layer, which is what the conv kernel learns from.
+  gradients[length-1].noalias() = gradients[length-2] * layers[0].weights->transpose();
+  gradients[length-1].array() *= layers[0].dZ->array();
   for (int i = 0; i < length-1; i++) {
     std::cout << learning_rate << " (LR) \n" << deltas[i] << "\n\n";
-    *layers[length-2-i].weights -= learning_rate * deltas[i];   
-    *layers[length-1-i].bias -= bias_lr * gradients[i];
+    *layers[length-2-i].weights -= learning_rate * deltas[i];
+    workspace.bias_grads[i].noalias() = gradients[i].colwise().sum();
+    *layers[length-1-i].bias -= bias_lr * workspace.bias_grads[i];
   }
   //  list_net();
-  // std::cout << "GRADIENT LIST\n";
-  // for (int i = 0; i < gradients.size(); i++) {
-  //   std::cout  << gradients[i] << "\n\n";
-  // }
-  Eigen::Map<Eigen::MatrixXf> reshaped(gradients[gradients.size()-1].data(), conv_layers[conv_layers.size()-1].output->rows(),conv_layers[conv_layers.size()-1].output->cols());
-  gradients[gradients.size()-1] = reshaped;
-  //std::cout << gradients[gradients.size()-1].cols() << " " << conv_layers[0].input->cols() << " " << conv_layers[0].input->cols() - gradients[length-1].cols()+1 << "\n";
-  for (int i = 0; i < conv_layers[0].input->cols() - gradients[length-1].cols()+1; i+=conv_layers[0].stride_len) {
-    for (int j = 0; j < conv_layers[0].input->rows() - gradients[length-1].rows()+1; j+=conv_layers[0].stride_len) {
-      (*conv_layers[0].kernel)(j, i) -= (gradients[length-1] * (conv_layers[0].input->block(j, i, gradients[length-1].rows(), gradients[length-1].cols()))).sum();
+  Eigen::Map<Eigen::MatrixXf> reshaped(gradients[length-1].data(), conv_layers[conv_layers.size()-1].output->rows(),conv_layers[conv_layers.size()-1].output->cols());
+  for (int i = 0; i < conv_layers[0].input->cols() - reshaped.cols()+1; i+=conv_layers[0].stride_len) {
+    for (int j = 0; j < conv_layers[0].input->rows() - reshaped.rows()+1; j+=conv_layers[0].stride_len) {
+      (*conv_layers[0].kernel)(j, i) -= (reshaped * (conv_layers[0].input->block(j, i, reshaped.rows(), reshaped.cols()))).sum();
     }
   }
-  conv_layers[0].bias -= gradients[gradients.size()-1].sum();
+  conv_layers[0].bias -= reshaped.sum();
 }
 
 void ConvNet::train()
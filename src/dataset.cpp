@@ -0,0 +1,185 @@
+#include "dataset.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Modification time of a file, in nanoseconds since the epoch.
+static int64_t modified(const struct stat& info)
+{
+#ifdef __APPLE__
+  return (int64_t) info.st_mtimespec.tv_sec * 1000000000 + info.st_mtimespec.tv_nsec;
+#else
+  return (int64_t) info.st_mtim.tv_sec * 1000000000 + info.st_mtim.tv_nsec;
+#endif
+}
+
+// Parses a CSV of numeric features with the label in the last column and writes it out in the
+// binary layout described by DatasetHeader. Blank lines are skipped. Returns the number of rows.
+// On a malformed CSV nothing is left behind at out_path.
+int convert_csv(char* path, char* out_path)
+{
+  FILE* rptr = fopen(path, "r");
+  if (rptr == NULL) throw std::runtime_error(std::string("Unable to open dataset `") + path + "`!");
+  FILE* wptr = fopen(out_path, "wb");
+  if (wptr == NULL) {
+    fclose(rptr);
+    throw std::runtime_error(std::string("Unable to write dataset cache `") + out_path + "`!");
+  }
+
+  struct stat source;
+  fstat(fileno(rptr), &source);
+  DatasetHeader header = {};
+  memcpy(header.magic, DATASET_MAGIC, sizeof(DATASET_MAGIC));
+  header.version = DATASET_VERSION;
+  header.source_size = source.st_size;
+  header.source_modified = modified(source);
+  fwrite(&header, sizeof(header), 1, wptr);
+
+  char* line = NULL;
+  size_t capacity = 0;
+  std::vector<float> row;
+  int width = -1;
+  while (getline(&line, &capacity, rptr) != -1) {
+    row.clear();
+    char* p = line;
+    char* end;
+    for (float value = strtof(p, &end); end != p; value = strtof(p, &end)) {
+      row.push_back(value);
+      p = end;
+      while (*p == ',' || *p == ' ') p++;
+    }
+    if (row.empty()) continue;
+    if (width == -1) width = row.size();
+    if ((int)row.size() != width) {
+      free(line);
+      fclose(rptr);
+      fclose(wptr);
+      unlink(out_path);
+      throw std::runtime_error(std::string("Inconsistent number of columns in `") + path + "`!");
+    }
+    fwrite(row.data(), sizeof(float), row.size(), wptr);
+    header.rows++;
+  }
+  free(line);
+  fclose(rptr);
+
+  header.inputs = width > 0 ? width-1 : 0;
+  fseek(wptr, 0, SEEK_SET);
+  fwrite(&header, sizeof(header), 1, wptr);
+  fclose(wptr);
+  return header.rows;
+}
+
+// Whether `cache` holds the current contents of the CSV described by `source`: a cache of this
+// version, made from a file of the same size and modification time.
+static bool fresh(const std::string& cache, const struct stat& source)
+{
+  int fd = open(cache.c_str(), O_RDONLY);
+  if (fd == -1) return false;
+  DatasetHeader header;
+  bool whole = pread(fd, &header, sizeof(header), 0) == sizeof(header);
+  close(fd);
+  return whole && memcmp(header.magic, DATASET_MAGIC, sizeof(DATASET_MAGIC)) == 0 && header.version == DATASET_VERSION
+    && header.source_size == (uint64_t) source.st_size && header.source_modified == modified(source);
+}
+
+// Where the cache of a CSV in a read-only directory goes: the directory named by the
+// JACOBIAN_CACHE_DIR environment variable, or else the system's temporary directory. The file is
+// named after the CSV plus a hash of its full path, so two datasets never share a cache.
+static std::string fallback_cache(char* path)
+{
+  const char* dir = getenv("JACOBIAN_CACHE_DIR");
+  if (dir == NULL || *dir == '\0') dir = P_tmpdir;
+  char* full = realpath(path, NULL);
+  std::string key = full != NULL ? full : path;
+  free(full);
+  char hash[17];
+  snprintf(hash, sizeof(hash), "%016zx", std::hash<std::string>{}(key));
+  return std::string(dir) + "/" + key.substr(key.find_last_of('/') + 1) + "." + hash + ".bin";
+}
+
+// Opens the binary cache of a CSV, converting the CSV first if the cache is missing or stale. The
+// cache sits next to the CSV (`<path>.bin`), or in fallback_cache() when that directory cannot be
+// written. Conversion goes through a temporary file and a rename so several processes starting on
+// the same data never see a half-written cache.
+Dataset* open_dataset(char* path)
+{
+  struct stat source;
+  if (stat(path, &source) == -1) throw std::runtime_error(std::string("Unable to open dataset `") + path + "`!");
+  std::string cache = std::string(path) + ".bin";
+  if (!fresh(cache, source)) {
+    std::string name (path);
+    size_t slash = name.find_last_of('/');
+    std::string dir = slash == std::string::npos ? "." : name.substr(0, slash + 1);
+    if (access(dir.c_str(), W_OK) != 0) cache = fallback_cache(path);
+  }
+  if (!fresh(cache, source)) {
+    std::string tmp = cache + "." + std::to_string(getpid()) + ".tmp";
+    convert_csv(path, (char*)tmp.c_str());
+    if (rename(tmp.c_str(), cache.c_str()) != 0) {
+      unlink(tmp.c_str());
+      throw std::runtime_error(std::string("Unable to write dataset cache `") + cache + "`!");
+    }
+  }
+  return new Dataset ((char*)cache.c_str());
+}
+
+Dataset::Dataset(char* path)
+{
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) throw std::runtime_error(std::string("Unable to open dataset cache `") + path + "`!");
+  struct stat info;
+  fstat(fd, &info);
+  length = info.st_size;
+  if (length < sizeof(DatasetHeader)) {
+    close(fd);
+    throw std::runtime_error(std::string("Truncated dataset cache `") + path + "`!");
+  }
+  mapping = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) throw std::runtime_error(std::string("Unable to map dataset cache `") + path + "`!");
+  madvise(mapping, length, MADV_WILLNEED);
+
+  const DatasetHeader* header = (const DatasetHeader*) mapping;
+  if (memcmp(header->magic, DATASET_MAGIC, sizeof(DATASET_MAGIC)) != 0 || header->version != DATASET_VERSION
+      || length < sizeof(DatasetHeader) + header->rows * (header->inputs+1) * sizeof(float)) {
+    munmap(mapping, length);
+    throw std::runtime_error(std::string("Invalid dataset cache `") + path + "`!");
+  }
+  rows = header->rows;
+  inputs = header->inputs;
+  feature_values = (const float*) ((const char*) mapping + sizeof(DatasetHeader));
+  label_values = feature_values + inputs;
+  feature_stride = inputs+1;
+  label_stride = inputs+1;
+}
+
+// Borrows the arrays, which must outlive the Dataset.
+Dataset::Dataset(const float* features, const float* labels, int rows, int inputs)
+  :rows{rows}, inputs{inputs}, feature_values{features}, label_values{labels}, feature_stride{inputs}, label_stride{1}
+{
+}
+
+Dataset::~Dataset()
+{
+  if (mapping != nullptr) munmap(mapping, length);
+}
+
+FeatureMap Dataset::features(int start, int n)
+{
+  return FeatureMap(feature_values + (size_t)start * feature_stride, n, inputs, Eigen::OuterStride<>(feature_stride));
+}
+
+LabelMap Dataset::labels(int start, int n)
+{
+  return LabelMap(label_values + (size_t)start * label_stride, n, Eigen::InnerStride<>(label_stride));
+}
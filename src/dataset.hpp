@@ -0,0 +1,56 @@
+#ifndef DATASET_H
+#define DATASET_H
+
+#include <Eigen/Dense>
+
+#include <cstdint>
+#include <cstddef>
+
+typedef Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> RowMatrixXf;
+typedef Eigen::Map<const RowMatrixXf, 0, Eigen::OuterStride<>> FeatureMap;
+typedef Eigen::Map<const Eigen::VectorXf, 0, Eigen::InnerStride<>> LabelMap;
+
+#define DATASET_MAGIC "JCBDATA"
+#define DATASET_VERSION 2
+
+// Header of the binary dataset files written by convert_csv. It is padded to 64 bytes so the first
+// row starts on a cache line. Each row is stored row-major exactly like the CSV line it came from:
+// `inputs` features followed by the label, so consecutive rows form one contiguous block. Rows are
+// not padded, so later rows only start on a cache line when inputs+1 is a multiple of 16.
+struct DatasetHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t inputs;
+  uint64_t rows;
+  uint64_t source_size; // of the CSV the cache was made from, to tell when it is stale
+  int64_t source_modified; // nanoseconds since the epoch
+  char padding[24];
+};
+
+// A converted dataset, memory-mapped read-only, or a pair of caller-owned arrays (row-major
+// features and one label per row) borrowed without copying. Batches are handed out as Eigen::Map
+// views straight into that memory, so nothing is parsed or copied when they are read.
+class Dataset {
+public:
+  int rows;
+  int inputs;
+
+  Dataset(char* path);
+  Dataset(const float* features, const float* labels, int rows, int inputs);
+  ~Dataset();
+  FeatureMap features(int start, int n);
+  LabelMap labels(int start, int n);
+
+private:
+  void* mapping = nullptr;
+  size_t length = 0;
+  const float* feature_values;
+  const float* label_values;
+  int feature_stride; // floats from one row's features to the next
+  int label_stride;
+};
+
+int convert_csv(char* path, char* out_path);
+Dataset* open_dataset(char* path);
+
+#endif /* DATASET_H */
@@ -0,0 +1,180 @@
+#include "ensemble.hpp"
+#include "validation.hpp"
+#include "trace.hpp"
+
+Ensemble::Ensemble(char* path, int k, int batch_sz, float learn_rate, float bias_rate, float l, float ratio)
+  :Network(path, batch_sz, learn_rate, bias_rate, l, ratio),
+   learning_rates(k, learn_rate), base_rates(k, learn_rate), bias_lrs(k, bias_rate), lambdas(k, l),
+   member_acc(k, 0), member_cost(k, 0), member_val_acc(k, 0), member_val_cost(k, 0), member_stats(k)
+{
+  members = k;
+}
+
+// The input layer is shared by every member, the rest are stored `members` times side by side.
+void Ensemble::add_layer(int nodes, char* activation)
+{
+  widths.push_back(nodes);
+  Network::add_layer(length == 0 ? nodes : nodes * members, activation);
+}
+
+void Ensemble::set_hyperparameters(int member, float learn_rate, float bias_rate, float l)
+{
+  base_rates[member] = learn_rate;
+  learning_rates[member] = learn_rate * rate_scale;
+  bias_lrs[member] = bias_rate;
+  lambdas[member] = l;
+}
+
+// Each member's block gets its own draws from the same distribution Layer::init_weights uses;
+// everything off the block diagonal stays zero for good, since backpropagate never writes there.
+// Otherwise as Network::initialize.
+void Ensemble::initialize()
+{
+  delete labels;
+  labels = new Eigen::MatrixXf (max_batch, widths[length-1]);
+  labels->setZero();
+  params.plan(layers, second_moment(optimizer.kind)); // zeroed
+  for (int i = 0; i < length-1; i++) {
+    int in = widths[i];
+    int out = widths[i+1];
+    std::normal_distribution<float> d(0, sqrt(1.0/(in + out)));
+    for (int k = 0; k < members; k++) {
+      auto block = layers[i].weights->block(i == 0 ? 0 : k*in, k*out, in, out);
+      for (int r = 0; r < in; r++) {
+        for (int c = 0; c < out; c++) block(r, c) = d(rng);
+      }
+    }
+  }
+  workspace.plan(layers, max_batch);
+  use_rows(batch_size);
+  reset_optimizer();
+  weight_norm = squared_weights();
+  drop_validator();
+}
+
+void Ensemble::feedforward()
+{
+  forward_pass(layers, *labels, &workspace, member_stats.data(), members);
+}
+
+void Ensemble::backpropagate()
+{
+  compute_gradients(layers, workspace);
+  update_members(workspace);
+}
+
+// compute_gradients runs once over the stacked layers. Its weight deltas also contain the
+// cross-member blocks, which are simply never applied: each member only updates its own block
+// with its own rates, from the gradients in ws, through the network's optimizer. A member's block
+// is a run of columns of the stacked matrix, and every column of it is contiguous, so the update
+// goes through apply_update a column at a time, with the optimizer state at the same offsets.
+void Ensemble::update_members(Workspace& ws)
+{
+  TRACE("update");
+  long t = ++steps;
+  bool adaptive = optimizer.kind == Optimizer::Adam || optimizer.kind == Optimizer::AdamW;
+  float* v = params.arena + params.size;
+  float* s = params.mirrors > 2 ? params.arena + 2*params.size : nullptr;
+  auto update = [&](float* w, const float* g, Eigen::Index n, float lr, float shrink, float decay, float l2) -> void {
+    Eigen::Index at = w - params.arena;
+    apply_update(optimizer, w, v + at, s != nullptr ? s + at : nullptr, g, n, lr, shrink, decay, l2, t);
+  };
+  for (int i = 0; i < length-1; i++) {
+    Layer& layer = layers[length-2-i];
+    int in = widths[length-2-i];
+    int out = widths[length-1-i];
+    bool shared = length-2-i == 0;
+    Eigen::Index stride = layer.weights->rows();
+    for (int k = 0; k < members; k++) {
+      int row = shared ? 0 : k*in;
+      float shrink = adaptive ? 1 : 1 - lambdas[k]/batch_rows;
+      float l2 = optimizer.kind == Optimizer::Adam ? lambdas[k]*batch_rows : 0;
+      for (int c = k*out; c < (k+1)*out; c++) {
+        update(layer.weights->data() + c*stride + row, ws.deltas[i].data() + c*stride + row, in,
+               learning_rates[k], shrink, lambdas[k], l2);
+      }
+      update(layers[length-1-i].bias->data() + k*out, ws.bias_grads[i].data() + k*out, out, bias_lrs[k], 1, 0, 0);
+    }
+  }
+}
+
+// Sum of one member's squared weights, for its L2 term.
+float Ensemble::member_squares(int member)
+{
+  float reg = 0;
+  for (int i = 0; i < length-1; i++) {
+    int in = widths[i];
+    int out = widths[i+1];
+    reg += layers[i].weights->block(i == 0 ? 0 : member*in, member*out, in, out).squaredNorm();
+  }
+  return reg;
+}
+
+float Ensemble::member_cost_of(int member)
+{
+  return (1.0/batch_rows) * member_stats[member].loss + 0.5f*lambdas[member]*member_squares(member);
+}
+
+float Ensemble::member_accuracy_of(int member)
+{
+  return (1.0/batch_rows) * member_stats[member].correct;
+}
+
+// Scores every member on the whole validation split through the Validator, as Network::test does,
+// with one softmax per member.
+float Ensemble::test()
+{
+  gather_validation(members);
+  validator->run(params.arena);
+  for (int k = 0; k < members; k++) {
+    member_val_acc[k] = validator->member_accuracy[k];
+    member_val_cost[k] = validator->member_loss[k] + 0.5f*lambdas[k]*member_squares(k);
+  }
+  return 0;
+}
+
+// One epoch over every training row, as in Network::train_epoch: every step is cut into the same
+// micro-batches, the last batch holds whatever is left over, and the sums are over rows so that
+// batch counts for its size.
+void Ensemble::train()
+{
+  shuffle_rows();
+  cursor = 0;
+  std::vector<float> cost_sum (members, 0);
+  std::vector<float> acc_sum (members, 0);
+  int total = (instances + batch_size - 1) / batch_size;
+  for (int b = 0; b < total; b++) {
+    next_batch();
+    update_members(micro_step(member_stats.data()));
+    for (int k = 0; k < members; k++) {
+      cost_sum[k] += batch_rows * member_cost_of(k);
+      acc_sum[k] += batch_rows * member_accuracy_of(k);
+    }
+    batches++;
+  }
+  for (int k = 0; k < members; k++) {
+    member_acc[k] = acc_sum[k] / instances;
+    member_cost[k] = cost_sum[k] / instances;
+  }
+  test();
+  if (verbose) {
+    for (int k = 0; k < members; k++) {
+      printf("Epoch %i member %i complete - cost %f - acc %f - val_cost %f - val_acc %f\n", epochs, k, member_cost[k], member_acc[k], member_val_cost[k], member_val_acc[k]);
+    }
+  }
+  batches=1;
+  cursor = 0;
+  // The schedule is run on a unit rate (in units of a_0 for the schedules that start from it) and
+  // scales every member's own rate, so members keep their relative rates as they decay.
+  float unit = decay_a0 != 0 ? decay_a0 : 1;
+  rate_scale = decay(rate_scale * unit, epochs) / unit;
+  for (int k = 0; k < members; k++) {
+    learning_rates[k] = base_rates[k] * rate_scale;
+  }
+  epochs++;
+}
+
+float Ensemble::get_acc(int member) {return member_acc[member];}
+float Ensemble::get_val_acc(int member) {return member_val_acc[member];}
+float Ensemble::get_cost(int member) {return member_cost[member];}
+float Ensemble::get_val_cost(int member) {return member_val_cost[member];}
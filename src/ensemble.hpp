@@ -0,0 +1,54 @@
+#ifndef ENSEMBLE_H
+#define ENSEMBLE_H
+
+#include "bpnn.hpp"
+
+// K networks with the same topology trained together on the same batches. Every non-input layer
+// stores the K members side by side, so layer i is K times as wide as one member's layer i:
+//   - the first weight matrix is the members' first weight matrices concatenated column-wise, so
+//     one GEMM feeds the shared input batch to all of them;
+//   - every later weight matrix is block-diagonal, with member k's weights in diagonal block k;
+//   - biases, activations and the softmax output are likewise K blocks of columns.
+// A single forward and backward pass therefore trains all K members. Each member has its own
+// initialization and its own learning rate, bias learning rate and regularization strength, and
+// reports its own metrics through the usual getters, indexed by member. The decay schedule and the
+// optimizer are shared: each member's rate decays by the same factor, and each member's block is
+// updated by the same optimizer with its own rates.
+//
+// Only the methods declared here, plus seed, set_shuffle, init_decay, init_optimizer, set_batch_size
+// and checksum, know about the members. The rest of Network (threads, prefetch, fit, checkpoints,
+// forks, ...) would treat the stacked layers as one network, so the Python bindings do not expose them.
+class Ensemble : public Network {
+public:
+  std::vector<int> widths; // nodes per layer of a single member
+  std::vector<float> learning_rates; // current, after decay
+  std::vector<float> base_rates; // as set, before decay
+  float rate_scale = 1; // how far the decay schedule has brought the rates so far
+  std::vector<float> bias_lrs;
+  std::vector<float> lambdas;
+  std::vector<float> member_acc;
+  std::vector<float> member_cost;
+  std::vector<float> member_val_acc;
+  std::vector<float> member_val_cost;
+  std::vector<OutputStats> member_stats; // of the last batch fed forward
+
+  Ensemble(char* path, int k, int batch_sz, float learn_rate, float bias_rate, float l, float ratio);
+  void add_layer(int nodes, char* activation);
+  void set_hyperparameters(int member, float learn_rate, float bias_rate, float l);
+  void initialize();
+  void feedforward();
+  void backpropagate();
+  void update_members(Workspace& ws);
+  float member_squares(int member);
+  float member_cost_of(int member);
+  float member_accuracy_of(int member);
+  float test();
+  void train();
+
+  float get_acc(int member);
+  float get_cost(int member);
+  float get_val_acc(int member);
+  float get_val_cost(int member);
+};
+
+#endif /* ENSEMBLE_H */
@@ -0,0 +1,87 @@
+#include "inference.hpp"
+#include "checkpoint.hpp"
+#include "kernels.hpp"
+
+CompiledModel::CompiledModel(Network& net)
+{
+  inputs = net.layers[0].contents->cols();
+  widest = inputs;
+  for (int i = 0; i < net.length; i++) {
+    Layer& layer = net.layers[i];
+    kinds.push_back(layer.activation_kind);
+    activations.push_back(layer.activation);
+    widest = std::max(widest, (int) layer.contents->cols());
+    if (i > 0) owned_biases.push_back(layer.bias->row(0));
+    if (i < net.length-1) owned_weights.push_back(*layer.weights);
+  }
+  for (Eigen::RowVectorXf& b : owned_biases) biases.emplace_back(b.data(), b.size());
+  for (Eigen::MatrixXf& w : owned_weights) weights.emplace_back(w.data(), w.rows(), w.cols());
+}
+
+// Maps the parameters of a checkpoint written by save_checkpoint without copying them. A checkpoint
+// only names its activations, so a layer with a custom one cannot be served from it.
+CompiledModel::CompiledModel(const char* checkpoint)
+  :mapped{std::make_shared<Checkpoint>(checkpoint)}
+{
+  const CheckpointLayer* layers = mapped->layers;
+  int length = mapped->header->layers;
+  inputs = layers[0].nodes;
+  widest = inputs;
+  for (int i = 0; i < length; i++) {
+    kinds.push_back(parse_activation(layers[i].activation));
+    if (kinds.back() == Activation::Custom) {
+      throw std::invalid_argument(std::string("Layer ") + std::to_string(i) + " of checkpoint `" + checkpoint + "` has the unknown activation `"
+                                  + std::string(layers[i].activation, strnlen(layers[i].activation, sizeof(layers[i].activation)))
+                                  + "`; only built-in activations can be served from a checkpoint!");
+    }
+    activations.push_back(nullptr);
+    widest = std::max(widest, (int) layers[i].nodes);
+    if (i > 0) biases.emplace_back(mapped->biases[i], layers[i].nodes);
+    if (i < length-1) weights.emplace_back(mapped->weights[i], layers[i].nodes, layers[i+1].nodes);
+  }
+}
+
+int CompiledModel::classes() const
+{
+  return weights.back().cols();
+}
+
+InferenceContext::InferenceContext(const CompiledModel& model)
+  :model{model}
+{
+}
+
+// Class probabilities for n row-major input rows, as n x classes() row-major floats. The returned
+// buffer belongs to the context and is overwritten by the next call.
+const float* InferenceContext::predict(const float* rows, int n)
+{
+  size_t size = (size_t)n * model.widest;
+  if (front.size() < size) {
+    front.resize(size);
+    back.resize(size);
+  }
+  Eigen::Map<RowMatrixXf> input (front.data(), n, model.inputs);
+  input = Eigen::Map<const RowMatrixXf>(rows, n, model.inputs);
+  apply_activation(model.kinds[0], model.activations[0], front.data(), (Eigen::Index)n * model.inputs);
+  float* in = front.data();
+  float* out = back.data();
+  for (int i = 0; i < (int) model.weights.size(); i++) {
+    const Eigen::Map<const Eigen::MatrixXf>& w = model.weights[i];
+    Eigen::Map<const RowMatrixXf> x (in, n, w.rows());
+    Eigen::Map<RowMatrixXf> z (out, n, w.cols());
+    z.noalias() = x * w;
+    z.rowwise() += model.biases[i];
+    apply_activation(model.kinds[i+1], model.activations[i+1], out, (Eigen::Index)n * w.cols());
+    std::swap(in, out);
+  }
+  int k = model.classes();
+  float sum = kernels->softmax(in, n, k, k, 1);
+  checknan(sum, "sum in Softmax operation");
+  return in;
+}
+
+void InferenceContext::predict(const float* rows, int n, float* out)
+{
+  const float* probs = predict(rows, n);
+  std::copy(probs, probs + (size_t)n * model.classes(), out);
+}
@@ -0,0 +1,51 @@
+#ifndef INFERENCE_H
+#define INFERENCE_H
+
+#include "bpnn.hpp"
+
+#include <memory>
+#include <vector>
+
+class Checkpoint;
+
+// Immutable snapshot of a trained Network for serving. It holds one copy of the weights, biases
+// and activations and is never written after construction, so any number of threads can predict
+// against it at once, each through its own InferenceContext. Built from a checkpoint file, the
+// parameters are views into the read-only mapping instead, shared with every other process that
+// maps the same file.
+class CompiledModel {
+public:
+  int inputs;
+  int widest; // nodes in the widest layer, for sizing scratch buffers
+  std::vector<Eigen::Map<const Eigen::MatrixXf>> weights; // weights[i] feeds layer i+1
+  std::vector<Eigen::Map<const Eigen::RowVectorXf>> biases; // biases[i] belongs to layer i+1
+  std::vector<Activation> kinds; // kinds[i] is the activation of layer i
+  std::vector<std::function<float(float)>> activations;
+
+  CompiledModel(Network& net);
+  CompiledModel(const char* checkpoint);
+  CompiledModel(const CompiledModel&) = delete; // the views point into this object
+  int classes() const;
+
+private:
+  std::vector<Eigen::MatrixXf> owned_weights;
+  std::vector<Eigen::RowVectorXf> owned_biases;
+  std::shared_ptr<Checkpoint> mapped;
+};
+
+// Per-thread scratch space for running a CompiledModel. predict() takes any number of rows and only
+// computes activations, never their derivatives. Buffers grow to the largest n seen and are reused.
+class InferenceContext {
+public:
+  const CompiledModel& model;
+
+  InferenceContext(const CompiledModel& model);
+  const float* predict(const float* rows, int n);
+  void predict(const float* rows, int n, float* out);
+
+private:
+  std::vector<float> front;
+  std::vector<float> back;
+};
+
+#endif /* INFERENCE_H */
@@ -0,0 +1,72 @@
+#include "job.hpp"
+
+#include <chrono>
+
+TrainingJob::TrainingJob(Network& net, int epochs, std::function<void()> epoch, std::function<void(TrainingProgress&)> metrics)
+  :net{net}, epoch{epoch}, metrics{metrics}
+{
+  if (this->epoch == nullptr) this->epoch = [&net]() {net.train();};
+  if (this->metrics == nullptr) {
+    this->metrics = [&net](TrainingProgress& p) {
+      p.cost = net.get_cost();
+      p.acc = net.get_acc();
+      p.val_cost = net.get_val_cost();
+      p.val_acc = net.get_val_acc();
+    };
+  }
+  current = TrainingProgress{};
+  current.total = epochs;
+  worker = std::thread([this, epochs]() {
+    try {
+      for (int i = 0; i < epochs && !cancelled.load(std::memory_order_relaxed); i++) {
+        this->epoch();
+        TrainingProgress next{};
+        next.epochs = i+1;
+        next.total = epochs;
+        this->metrics(next);
+        std::lock_guard<std::mutex> guard (lock);
+        current = next;
+      }
+    }
+    catch (...) {
+      error = std::current_exception();
+    }
+    std::lock_guard<std::mutex> guard (lock);
+    complete = true;
+    finished.notify_all();
+  });
+}
+
+TrainingJob::~TrainingJob()
+{
+  cancel();
+  worker.join();
+}
+
+bool TrainingJob::done()
+{
+  std::lock_guard<std::mutex> guard (lock);
+  return complete;
+}
+
+// Blocks until the job finishes, or for at most `timeout` seconds if it is not negative. Returns
+// whether the job is done.
+bool TrainingJob::wait(double timeout)
+{
+  std::unique_lock<std::mutex> guard (lock);
+  if (timeout < 0) finished.wait(guard, [this]() {return complete;});
+  else finished.wait_for(guard, std::chrono::duration<double>(timeout), [this]() {return complete;});
+  if (complete && error) std::rethrow_exception(error);
+  return complete;
+}
+
+void TrainingJob::cancel()
+{
+  cancelled.store(true, std::memory_order_relaxed);
+}
+
+TrainingProgress TrainingJob::progress()
+{
+  std::lock_guard<std::mutex> guard (lock);
+  return current;
+}
@@ -0,0 +1,56 @@
+#ifndef JOB_H
+#define JOB_H
+
+#include "bpnn.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Where a TrainingJob has got to: epochs finished so far and the metrics after the last of them.
+// For an Ensemble the scalars stay 0 and the member_ vectors hold one entry per member.
+struct TrainingProgress {
+  int epochs;
+  int total;
+  float cost;
+  float acc;
+  float val_cost;
+  float val_acc;
+  std::vector<float> member_cost;
+  std::vector<float> member_acc;
+  std::vector<float> member_val_cost;
+  std::vector<float> member_val_acc;
+};
+
+// Trains a network for a number of epochs on a background thread. `epoch` runs one epoch (by default
+// net.train()) and `metrics` fills in the progress after it (by default from net's getters); the
+// network must not be used from elsewhere until the job is done. cancel() stops the job once the
+// epoch in progress finishes. If an epoch throws, wait() rethrows the exception.
+class TrainingJob {
+public:
+  TrainingJob(Network& net, int epochs, std::function<void()> epoch = nullptr,
+              std::function<void(TrainingProgress&)> metrics = nullptr);
+  ~TrainingJob();
+  bool done();
+  bool wait(double timeout = -1);
+  void cancel();
+  TrainingProgress progress();
+
+private:
+  Network& net;
+  std::function<void()> epoch;
+  std::function<void(TrainingProgress&)> metrics;
+  std::atomic<bool> cancelled {false};
+  std::mutex lock;
+  std::condition_variable finished;
+  bool complete = false;
+  TrainingProgress current;
+  std::exception_ptr error;
+  std::thread worker;
+};
+
+#endif /* JOB_H */
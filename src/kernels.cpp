@@ -0,0 +1,76 @@
+#include "kernels.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+#define KERNEL_NAMESPACE kernels_generic
+#define KERNEL_ISA 0
+#define KERNEL_WIDTH 16
+#define KERNEL_TABLE generic_kernels
+#define KERNEL_NAME "generic"
+#include "kernels.inc"
+
+// Every table, slowest first, with whether this CPU (and OS) can run it.
+static std::vector<std::pair<const KernelTable*, bool>> tables()
+{
+  std::vector<std::pair<const KernelTable*, bool>> all = {{&generic_kernels, true}};
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  bool avx512 = __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")
+    && __builtin_cpu_supports("avx512dq") && __builtin_cpu_supports("avx512vl");
+  all.emplace_back(&sse42_kernels, __builtin_cpu_supports("sse4.2"));
+  all.emplace_back(&avx2_kernels, __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"));
+  all.emplace_back(&avx512_kernels, avx512);
+  all.emplace_back(&avx512_vnni_kernels, avx512 && __builtin_cpu_supports("avx512vnni"));
+#endif
+  return all;
+}
+
+// Starts on the generic table so anything running before this file's initializer still works.
+const KernelTable* kernels = &generic_kernels;
+
+static bool select_kernels()
+{
+  for (auto& table : tables()) {
+    if (table.second) kernels = table.first;
+  }
+  const char* requested = getenv("JACOBIAN_KERNELS");
+  if (requested != nullptr && *requested != '\0') {
+    try {
+      use_kernels(requested);
+    }
+    catch (std::invalid_argument& e) {
+      fprintf(stderr, "JACOBIAN_KERNELS: %s; using %s.\n", e.what(), kernels->name);
+    }
+  }
+  return true;
+}
+
+static bool selected = select_kernels();
+
+const char* kernel_path()
+{
+  return kernels->name;
+}
+
+std::vector<std::string> kernel_paths()
+{
+  std::vector<std::string> names;
+  for (auto& table : tables()) {
+    if (table.second) names.push_back(table.first->name);
+  }
+  return names;
+}
+
+void use_kernels(const char* name)
+{
+  for (auto& table : tables()) {
+    if (strcmp(table.first->name, name) != 0) continue;
+    if (!table.second) throw std::invalid_argument(std::string("This CPU can't run the `") + name + "` kernels");
+    kernels = table.first;
+    return;
+  }
+  throw std::invalid_argument(std::string("Unknown kernels `") + name + "`");
+}
@@ -0,0 +1,61 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include "utils.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// The elementwise hot loops of training and inference, compiled once per instruction set level
+// (kernels_sse42.cpp, kernels_avx2.cpp, kernels_avx512.cpp, plus a generic build in kernels.cpp)
+// from the same source, kernels.inc. The best table the CPU supports is picked through CPUID when
+// the library loads, so one binary runs everywhere and uses AVX-512 where it exists. Matrix
+// products stay with Eigen, or with MKL in the `faster` builds, which dispatches on its own.
+struct KernelTable {
+  const char* name;
+  // Overwrites z[0..n) with the activation and writes its derivative into dz[0..n).
+  void (*activate)(Activation kind, float* z, float* dz, int64_t n);
+  // Overwrites z[0..n) with the activation only.
+  void (*activate_forward)(Activation kind, float* z, int64_t n);
+  // Softmax over each row of a rows x cols matrix whose element (r, c) is x[r*row_stride + c*col_stride].
+  // Returns the sum of the rows' exponentials, for NaN checks.
+  float (*softmax)(float* x, int rows, int cols, int64_t row_stride, int64_t col_stride);
+  // Summed -log of each row's probability at its label, with 0 read as 0.00001. Rows whose label
+  // is not a column are skipped.
+  float (*cross_entropy)(const float* x, int rows, int cols, int64_t row_stride, int64_t col_stride, const float* labels);
+  // The output layer of training in one pass: softmax of x in place, as above, adding each row's
+  // cross-entropy (from the log-softmax, so exact where a probability underflows) to *loss and 1 to
+  // *correct for each row whose first largest logit is its label. Unless error is null it also
+  // receives p - onehot(label), laid out like x. Rows whose label is not a column add nothing.
+  float (*softmax_loss)(float* x, int rows, int cols, int64_t row_stride, int64_t col_stride, const float* labels,
+                        float* error, float* loss, float* correct);
+  // Number of rows whose first largest entry is in their label's column.
+  float (*accuracy)(const float* x, int rows, int cols, int64_t row_stride, int64_t col_stride, const float* labels);
+  // Symmetric int8 quantization of x[0..n) into q; returns the scale (max |x| / 127).
+  float (*quantize_row)(const float* x, int n, int8_t* q);
+  // Dot product of two int8 rows of `stride` bytes (a multiple of 64). colsum is the sum of w, which
+  // kernels that bias a to unsigned need to undo it.
+  int32_t (*dot_i8)(const int8_t* a, const int8_t* w, int stride, int32_t colsum);
+};
+
+extern const KernelTable generic_kernels;
+#if defined(__x86_64__) || defined(__i386__)
+extern const KernelTable sse42_kernels;
+extern const KernelTable avx2_kernels;
+extern const KernelTable avx512_kernels;
+extern const KernelTable avx512_vnni_kernels;
+#endif
+
+extern const KernelTable* kernels; // the table in use
+
+// Name of the table in use: "generic", "sse4.2", "avx2", "avx512" or "avx512-vnni".
+const char* kernel_path();
+// Every table this CPU can run, slowest first.
+std::vector<std::string> kernel_paths();
+// Switches to the named table, e.g. to compare paths. Throws std::invalid_argument if the name is
+// unknown or the CPU lacks the instructions. The JACOBIAN_KERNELS environment variable does the
+// same when the library loads.
+void use_kernels(const char* name);
+
+#endif /* KERNELS_H */
@@ -0,0 +1,22 @@
+#include "kernels.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+#if defined(__clang__)
+#pragma clang attribute push (__attribute__((target("avx2,fma,f16c,bmi,bmi2,lzcnt,popcnt"))), apply_to = function)
+#else
+#pragma GCC target("avx2,fma,f16c,bmi,bmi2,lzcnt,popcnt")
+#endif
+
+#define KERNEL_NAMESPACE kernels_avx2
+#define KERNEL_ISA 2
+#define KERNEL_WIDTH 32
+#define KERNEL_TABLE avx2_kernels
+#define KERNEL_NAME "avx2"
+#include "kernels.inc"
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#endif
+#endif
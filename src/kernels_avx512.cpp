@@ -0,0 +1,23 @@
+#include "kernels.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+// Full 512-bit vectors: GCC otherwise sticks to 256 bits on AVX-512 targets.
+#if defined(__clang__)
+#pragma clang attribute push (__attribute__((target("avx512f,avx512bw,avx512dq,avx512vl,avx512cd,avx2,fma,f16c,bmi,bmi2,lzcnt,popcnt,prefer-vector-width=512"))), apply_to = function)
+#else
+#pragma GCC target("avx512f,avx512bw,avx512dq,avx512vl,avx512cd,avx2,fma,f16c,bmi,bmi2,lzcnt,popcnt,prefer-vector-width=512")
+#endif
+
+#define KERNEL_NAMESPACE kernels_avx512
+#define KERNEL_ISA 3
+#define KERNEL_WIDTH 64
+#define KERNEL_TABLE avx512_kernels
+#define KERNEL_NAME "avx512"
+#include "kernels.inc"
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#endif
+#endif
@@ -0,0 +1,22 @@
+#include "kernels.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+#if defined(__clang__)
+#pragma clang attribute push (__attribute__((target("sse4.2,popcnt"))), apply_to = function)
+#else
+#pragma GCC target("sse4.2,popcnt")
+#endif
+
+#define KERNEL_NAMESPACE kernels_sse42
+#define KERNEL_ISA 1
+#define KERNEL_WIDTH 16
+#define KERNEL_TABLE sse42_kernels
+#define KERNEL_NAME "sse4.2"
+#include "kernels.inc"
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#endif
+#endif
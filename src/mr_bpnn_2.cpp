@@ -1,6 +1,18 @@
 #include <pybind11/pybind11.h>
 #include <pybind11/functional.h>
+#include <pybind11/stl.h>
+#include <pybind11/numpy.h>
 #include "bpnn.hpp"
+#include "sweep.hpp"
+#include "ensemble.hpp"
+#include "quantize.hpp"
+#include "inference.hpp"
+#include "job.hpp"
+#include "sparse.hpp"
+#include "checkpoint.hpp"
+#include "snapshot.hpp"
+#include "trace.hpp"
+#include "kernels.hpp"
 namespace py = pybind11;
 
 // struct pair* map (struct pair input_pair)
@@ -103,25 +115,291 @@ namespace py = pybind11;
 //   free(line);
 // }
 
+// Checks that a buffer (NumPy array, memoryview, ...) holds C-contiguous values of type T with the
+// given number of dimensions, so its memory can be used in place.
+template <typename T>
+static py::buffer_info typed_buffer(py::buffer b, int dims, const char* name)
+{
+  py::buffer_info info = b.request();
+  if (info.format != py::format_descriptor<T>::format() || info.ndim != dims) {
+    throw std::invalid_argument(std::string(name) + " must be a " + std::to_string(dims) + "-d " + py::format_descriptor<T>::format() + " array");
+  }
+  py::ssize_t expected = sizeof(T);
+  for (int i = dims-1; i >= 0; i--) {
+    if (info.shape[i] > 1 && info.strides[i] != expected) {
+      throw std::invalid_argument(std::string(name) + " must be C-contiguous");
+    }
+    expected *= info.shape[i];
+  }
+  return info;
+}
+
+// Hands a row-major Eigen matrix to NumPy, which frees it when the array is collected.
+static py::array_t<float> to_numpy(RowMatrixXf* values)
+{
+  py::capsule owner (values, [](void* p) {delete (RowMatrixXf*) p;});
+  return py::array_t<float>({values->rows(), values->cols()}, values->data(), owner);
+}
+
+// Probabilities for every row of X, through a model compiled from the network's current weights.
+// The model is kept for the next call until a training step or one of the bindings that change the
+// weights or topology (add_layer, initialize, set_activation, update_layer, fit, load) drops it.
+static py::array_t<float> predict(Network& net, py::buffer x)
+{
+  py::buffer_info info = typed_buffer<float>(x, 2, "X");
+  if (net.compiled == nullptr || net.compiled_steps != net.steps) {
+    net.compiled = std::make_shared<CompiledModel>(net);
+    net.compiled_steps = net.steps;
+  }
+  std::shared_ptr<CompiledModel> model = net.compiled;
+  if (info.shape[1] != model->inputs) throw std::invalid_argument("X has the wrong number of columns");
+  InferenceContext context (*model);
+  RowMatrixXf* out = new RowMatrixXf (info.shape[0], model->classes());
+  {
+    py::gil_scoped_release release;
+    context.predict((const float*) info.ptr, info.shape[0], out->data());
+  }
+  return to_numpy(out);
+}
+
+// Joining a job waits for its thread, which may need the GIL to call a Python activation.
+struct JobDeleter {
+  void operator()(TrainingJob* job)
+  {
+    py::gil_scoped_release release;
+    delete job;
+  }
+};
+
 PYBIND11_MODULE(mrbpnn, m) {
   m.doc() = "Fast machine learning in C++"; // optional module docstring
  
   py::class_<Network>(m, "Network")
     .def(py::init<char*, int, float, float, float, float>())
-    .def("add_layer", &Network::add_layer, py::arg("nodes"), py::arg("activation"))
-    .def("initialize", &Network::initialize)
+    .def(py::init<int, float, float, float, float>(), py::arg("batch_size"), py::arg("learning_rate"), py::arg("bias_lr"), py::arg("l"), py::arg("ratio"))
+    .def("add_layer", [](Network& net, int nodes, char* activation) -> void {
+      net.compiled.reset();
+      net.add_layer(nodes, activation);
+    }, py::arg("nodes"), py::arg("activation"))
+    .def("initialize", [](Network& net) -> void {
+      net.compiled.reset();
+      net.initialize();
+    })
     .def("init_decay", &Network::init_decay, py::arg("type"), py::arg("a_0"), py::arg("k"))
-    .def("set_activation", &Network::set_activation)
-    .def("feedforward", &Network::feedforward)
-    .def("backpropagate", &Network::backpropagate)
+    .def("init_optimizer", &Network::init_optimizer, py::arg("type"), py::arg("beta1") = 0.9f, py::arg("beta2") = 0.999f, py::arg("epsilon") = 1e-8f)
+    .def("set_activation", [](Network& net, int index, std::function<float(float)> custom, std::function<float(float)> custom_deriv) -> void {
+      net.compiled.reset();
+      net.set_activation(index, custom, custom_deriv);
+    })
+    .def("seed", &Network::seed, py::arg("seed"))
+    .def("set_shuffle", &Network::set_shuffle, py::arg("chunk"))
+    .def("set_prefetch", &Network::set_prefetch, py::arg("depth"))
+    .def("set_threads", &Network::set_threads, py::arg("threads"))
+    .def("set_async", &Network::set_async, py::arg("threads"))
+    .def("set_micro_batches", &Network::set_micro_batches, py::arg("parts"))
+    .def("set_batch_size", &Network::set_batch_size, py::arg("rows"))
+    .def("set_batch_schedule", &Network::set_batch_schedule, py::arg("factor"), py::arg("every"), py::arg("largest"))
+    .def("set_validation", &Network::set_validation, py::arg("batch") = VALIDATION_BATCH, py::arg("background") = false)
+    .def("wait_validation", &Network::wait_validation, py::call_guard<py::gil_scoped_release>())
+    .def("feedforward", &Network::feedforward, py::call_guard<py::gil_scoped_release>())
+    .def("backpropagate", &Network::backpropagate, py::call_guard<py::gil_scoped_release>())
     .def("list_net", &Network::list_net)
     .def("cost", &Network::cost)
     .def("accuracy", &Network::accuracy)
-    .def("update_layer", &Network::update_layer, py::arg("vals"), py::arg("len"), py::arg("index"))
+    .def("update_layer", [](Network& net, py::buffer vals, int index) -> void {
+      py::buffer_info info = typed_buffer<float>(vals, 2, "vals");
+      if (index < 0 || index >= net.length) throw std::invalid_argument("index is not a layer of the network");
+      Layer& layer = net.layers[index];
+      if (info.shape[1] != layer.contents->cols()) throw std::invalid_argument("vals has the wrong number of columns");
+      if (info.shape[0] > layer.rows) throw std::invalid_argument("vals has more rows than the current batch");
+      net.compiled.reset();
+      net.update_layer((float*) info.ptr, info.size, index);
+    }, py::arg("vals"), py::arg("index"))
+    .def("fit", [](Network& net, py::buffer x, py::buffer y, int epochs) -> void {
+      py::buffer_info features = typed_buffer<float>(x, 2, "X");
+      py::buffer_info targets = typed_buffer<float>(y, 1, "y");
+      if (net.length == 0 || net.workspace.arena == nullptr) {
+        throw std::invalid_argument("call add_layer and initialize before fit");
+      }
+      if (features.shape[1] != net.layers[0].contents->cols()) throw std::invalid_argument("X has the wrong number of columns");
+      if (targets.shape[0] != features.shape[0]) throw std::invalid_argument("X and y have different numbers of rows");
+      net.compiled.reset();
+      py::gil_scoped_release release;
+      net.fit((const float*) features.ptr, (const float*) targets.ptr, features.shape[0], epochs);
+    }, py::arg("X"), py::arg("y"), py::arg("epochs") = 1, py::keep_alive<1, 2>(), py::keep_alive<1, 3>())
+    .def("predict", &predict, py::arg("X"))
+    .def("save", &save_checkpoint, py::arg("path"), py::call_guard<py::gil_scoped_release>())
+    .def("load", [](Network& net, const char* path) -> void {
+      net.compiled.reset();
+      py::gil_scoped_release release;
+      load_checkpoint(net, path);
+    }, py::arg("path"))
+    .def("train_async", [](Network& net, int epochs) -> TrainingJob* {
+      return new TrainingJob(net, epochs);
+    }, py::arg("epochs"), py::keep_alive<0, 1>())
     .def("next_batch", &Network::next_batch)
-    .def("train", &Network::train)
+    .def("checksum", &Network::checksum)
+    .def("snapshot", &Network::snapshot)
+    .def("fork", py::overload_cast<const Snapshot&>(&Network::fork), py::arg("snapshot"), py::keep_alive<0, 1>())
+    .def("fork", py::overload_cast<>(&Network::fork), py::keep_alive<0, 1>())
+    .def("train", &Network::train, py::call_guard<py::gil_scoped_release>())
     .def("get_acc", &Network::get_acc)
     .def("get_cost", &Network::get_cost)
     .def("get_val_acc", &Network::get_val_acc)
     .def("get_val_cost", &Network::get_val_cost);
+
+  py::class_<Snapshot>(m, "Snapshot")
+    .def_readonly("steps", &Snapshot::steps);
+
+  // Not bound as a subclass of Network: only the methods that know about the members are exposed.
+  py::class_<Ensemble>(m, "Ensemble")
+    .def(py::init<char*, int, int, float, float, float, float>(), py::arg("path"), py::arg("members"), py::arg("batch_size"), py::arg("learning_rate"), py::arg("bias_lr"), py::arg("l"), py::arg("ratio"))
+    .def("add_layer", &Ensemble::add_layer, py::arg("nodes"), py::arg("activation"))
+    .def("set_hyperparameters", &Ensemble::set_hyperparameters, py::arg("member"), py::arg("learning_rate"), py::arg("bias_lr"), py::arg("l"))
+    .def("initialize", &Ensemble::initialize)
+    .def("init_decay", &Ensemble::init_decay, py::arg("type"), py::arg("a_0"), py::arg("k"))
+    .def("init_optimizer", &Ensemble::init_optimizer, py::arg("type"), py::arg("beta1") = 0.9f, py::arg("beta2") = 0.999f, py::arg("epsilon") = 1e-8f)
+    .def("seed", &Ensemble::seed, py::arg("seed"))
+    .def("set_shuffle", &Ensemble::set_shuffle, py::arg("chunk"))
+    .def("set_batch_size", &Ensemble::set_batch_size, py::arg("rows"))
+    .def("checksum", &Ensemble::checksum)
+    .def("feedforward", &Ensemble::feedforward, py::call_guard<py::gil_scoped_release>())
+    .def("backpropagate", &Ensemble::backpropagate, py::call_guard<py::gil_scoped_release>())
+    .def("train", &Ensemble::train, py::call_guard<py::gil_scoped_release>())
+    .def("train_async", [](Ensemble& ensemble, int epochs) -> TrainingJob* {
+      return new TrainingJob(ensemble, epochs, [&ensemble]() {ensemble.train();}, [&ensemble](TrainingProgress& p) {
+        p.member_cost = ensemble.member_cost;
+        p.member_acc = ensemble.member_acc;
+        p.member_val_cost = ensemble.member_val_cost;
+        p.member_val_acc = ensemble.member_val_acc;
+      });
+    }, py::arg("epochs"), py::keep_alive<0, 1>())
+    .def("get_acc", &Ensemble::get_acc, py::arg("member"))
+    .def("get_cost", &Ensemble::get_cost, py::arg("member"))
+    .def("get_val_acc", &Ensemble::get_val_acc, py::arg("member"))
+    .def("get_val_cost", &Ensemble::get_val_cost, py::arg("member"));
+
+  // Not bound as a subclass of Network either: checkpoints, forks, predict, threads and the rest of
+  // Network know nothing of the embedding, so only the methods that do are exposed.
+  py::class_<SparseNetwork>(m, "SparseNetwork")
+    .def(py::init<char*, int, int, float, float, float, float>(), py::arg("path"), py::arg("inputs"), py::arg("batch_size"), py::arg("learning_rate"), py::arg("bias_lr"), py::arg("l"), py::arg("ratio"))
+    .def(py::init([](py::buffer indptr, py::buffer indices, py::buffer values, py::buffer y, int inputs, int batch_size, float learning_rate, float bias_lr, float l, float ratio) {
+      py::buffer_info ptr = typed_buffer<int>(indptr, 1, "indptr");
+      py::buffer_info cols = typed_buffer<int>(indices, 1, "indices");
+      py::buffer_info vals = typed_buffer<float>(values, 1, "data");
+      py::buffer_info targets = typed_buffer<float>(y, 1, "y");
+      if (ptr.shape[0] != targets.shape[0] + 1) throw std::invalid_argument("indptr must have one more entry than y");
+      if (cols.shape[0] != vals.shape[0]) throw std::invalid_argument("indices and data have different lengths");
+      SparseDataset* data = new SparseDataset ((const int*) ptr.ptr, (const int*) cols.ptr, (const float*) vals.ptr, (const float*) targets.ptr, targets.shape[0], inputs);
+      SparseNetwork* net = new SparseNetwork(data, batch_size, learning_rate, bias_lr, l, ratio);
+      net->opened_sparse = data;
+      return net;
+    }), py::arg("indptr"), py::arg("indices"), py::arg("data"), py::arg("y"), py::arg("inputs"), py::arg("batch_size"), py::arg("learning_rate"), py::arg("bias_lr"), py::arg("l"), py::arg("ratio"),
+      py::keep_alive<1, 2>(), py::keep_alive<1, 3>(), py::keep_alive<1, 4>(), py::keep_alive<1, 5>())
+    .def("add_layer", &SparseNetwork::add_layer, py::arg("nodes"), py::arg("activation"))
+    .def("initialize", &SparseNetwork::initialize)
+    .def("init_decay", &SparseNetwork::init_decay, py::arg("type"), py::arg("a_0"), py::arg("k"))
+    .def("init_optimizer", &SparseNetwork::init_optimizer, py::arg("type"), py::arg("beta1") = 0.9f, py::arg("beta2") = 0.999f, py::arg("epsilon") = 1e-8f)
+    .def("seed", &SparseNetwork::seed, py::arg("seed"))
+    .def("set_shuffle", &SparseNetwork::set_shuffle, py::arg("chunk"))
+    .def("feedforward", &SparseNetwork::feedforward, py::call_guard<py::gil_scoped_release>())
+    .def("backpropagate", &SparseNetwork::backpropagate, py::call_guard<py::gil_scoped_release>())
+    .def("train", &SparseNetwork::train, py::call_guard<py::gil_scoped_release>())
+    .def("train_async", [](SparseNetwork& net, int epochs) -> TrainingJob* {
+      return new TrainingJob(net, epochs, [&net]() {net.train();});
+    }, py::arg("epochs"), py::keep_alive<0, 1>())
+    .def("get_acc", &SparseNetwork::get_acc)
+    .def("get_cost", &SparseNetwork::get_cost)
+    .def("get_val_acc", &SparseNetwork::get_val_acc)
+    .def("get_val_cost", &SparseNetwork::get_val_cost);
+
+  py::class_<SweepResult>(m, "SweepResult")
+    .def_readonly("trial", &SweepResult::trial)
+    .def_readonly("config", &SweepResult::config)
+    .def_readonly("cost", &SweepResult::cost)
+    .def_readonly("acc", &SweepResult::acc)
+    .def_readonly("val_cost", &SweepResult::val_cost)
+    .def_readonly("val_acc", &SweepResult::val_acc)
+    .def_readonly("seconds", &SweepResult::seconds)
+    .def_readonly("error", &SweepResult::error);
+
+  py::class_<Sweep>(m, "Sweep")
+    .def(py::init<char*, float>(), py::arg("path"), py::arg("ratio"))
+    .def_readwrite("seed", &Sweep::seed)
+    .def("add_parameter", &Sweep::add_parameter, py::arg("name"), py::arg("distribution"), py::arg("min") = 0, py::arg("max") = 0, py::arg("values") = std::vector<std::string>())
+    .def("load_config", &Sweep::load_config, py::arg("path"))
+    .def("run", &Sweep::run, py::arg("trials"), py::arg("threads"), py::call_guard<py::gil_scoped_release>())
+    .def("print_results", &Sweep::print_results);
+
+  py::class_<QuantizationReport>(m, "QuantizationReport")
+    .def_readonly("rows", &QuantizationReport::rows)
+    .def_readonly("fp32_acc", &QuantizationReport::fp32_acc)
+    .def_readonly("fp32_cost", &QuantizationReport::fp32_cost)
+    .def_readonly("int8_acc", &QuantizationReport::int8_acc)
+    .def_readonly("int8_cost", &QuantizationReport::int8_cost)
+    .def_readonly("agreement", &QuantizationReport::agreement);
+
+  py::class_<QuantizedNetwork>(m, "QuantizedNetwork")
+    .def(py::init<Network&>(), py::arg("network"))
+    .def("predict", [](QuantizedNetwork& q, py::buffer x) -> py::array_t<float> {
+      py::buffer_info info = typed_buffer<float>(x, 2, "X");
+      if (info.shape[1] != q.inputs) throw std::invalid_argument("X has the wrong number of columns");
+      RowMatrixXf* out = new RowMatrixXf (info.shape[0], q.classes());
+      {
+        py::gil_scoped_release release;
+        q.predict((const float*) info.ptr, info.shape[0], out->data());
+      }
+      return to_numpy(out);
+    }, py::arg("X"))
+    .def("classes", &QuantizedNetwork::classes)
+    .def("weight_bytes", &QuantizedNetwork::weight_bytes);
+
+  m.def("quantization_report", &quantization_report, py::arg("network"), py::arg("quantized"), py::call_guard<py::gil_scoped_release>());
+  m.def("dot_kernel", &dot_kernel);
+
+  py::class_<CompiledModel>(m, "CompiledModel")
+    .def(py::init<Network&>(), py::arg("network"))
+    .def(py::init<const char*>(), py::arg("checkpoint"))
+    .def("classes", &CompiledModel::classes);
+
+  py::class_<InferenceContext>(m, "InferenceContext")
+    .def(py::init<const CompiledModel&>(), py::arg("model"), py::keep_alive<1, 2>())
+    .def("predict", [](InferenceContext& ctx, py::buffer x) -> py::array_t<float> {
+      py::buffer_info info = typed_buffer<float>(x, 2, "X");
+      if (info.shape[1] != ctx.model.inputs) throw std::invalid_argument("X has the wrong number of columns");
+      RowMatrixXf* out = new RowMatrixXf (info.shape[0], ctx.model.classes());
+      {
+        py::gil_scoped_release release;
+        ctx.predict((const float*) info.ptr, info.shape[0], out->data());
+      }
+      return to_numpy(out);
+    }, py::arg("X"));
+
+  py::class_<TrainingProgress>(m, "TrainingProgress")
+    .def_readonly("epochs", &TrainingProgress::epochs)
+    .def_readonly("total", &TrainingProgress::total)
+    .def_readonly("cost", &TrainingProgress::cost)
+    .def_readonly("acc", &TrainingProgress::acc)
+    .def_readonly("val_cost", &TrainingProgress::val_cost)
+    .def_readonly("val_acc", &TrainingProgress::val_acc)
+    .def_readonly("member_cost", &TrainingProgress::member_cost)
+    .def_readonly("member_acc", &TrainingProgress::member_acc)
+    .def_readonly("member_val_cost", &TrainingProgress::member_val_cost)
+    .def_readonly("member_val_acc", &TrainingProgress::member_val_acc);
+
+  py::class_<TrainingJob, std::unique_ptr<TrainingJob, JobDeleter>>(m, "TrainingJob")
+    .def("done", &TrainingJob::done)
+    .def("wait", &TrainingJob::wait, py::arg("timeout") = -1, py::call_guard<py::gil_scoped_release>())
+    .def("cancel", &TrainingJob::cancel)
+    .def("progress", &TrainingJob::progress);
+
+  m.def("trace_enable", &trace_enable);
+  m.def("trace_disable", &trace_disable);
+  m.def("trace_clear", &trace_clear);
+  m.def("trace_dump", &trace_dump, py::arg("path"));
+  m.def("trace_summary", &trace_summary);
+
+  m.def("kernel_path", &kernel_path);
+  m.def("kernel_paths", &kernel_paths);
+  m.def("use_kernels", &use_kernels, py::arg("name"));
 }
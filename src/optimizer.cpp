@@ -0,0 +1,90 @@
+#include "optimizer.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#define OPTIMIZER_CHUNK 1024 // floats per tensor slice, so all of a step's passes over it stay in L1
+
+typedef Eigen::Map<Eigen::ArrayXf> ArrayMap;
+typedef Eigen::Map<const Eigen::ArrayXf> ConstArrayMap;
+
+bool second_moment(Optimizer kind)
+{
+  return kind == Optimizer::Adam || kind == Optimizer::AdamW || kind == Optimizer::RMSProp;
+}
+
+Optimizer optimizer_kind(const char* name)
+{
+  if (strcmp(name, "sgd") == 0) return Optimizer::SGD;
+  if (strcmp(name, "momentum") == 0) return Optimizer::Momentum;
+  if (strcmp(name, "nesterov") == 0) return Optimizer::Nesterov;
+  if (strcmp(name, "adam") == 0) return Optimizer::Adam;
+  if (strcmp(name, "adamw") == 0) return Optimizer::AdamW;
+  if (strcmp(name, "rmsprop") == 0) return Optimizer::RMSProp;
+  throw std::invalid_argument(std::string("Unknown optimizer `") + name + "`!");
+}
+
+// Each slice of the tensor is read and written once per buffer; the expressions for one slice run
+// back to back while it is still in L1, so a step costs a single trip through memory.
+float apply_update(const OptimizerConfig& config, float* w, float* m, float* s, const float* g, Eigen::Index n,
+                  float lr, float shrink, float decay, float l2, long t)
+{
+  float b1 = config.beta1;
+  float b2 = config.beta2;
+  float eps = config.epsilon;
+  float c1 = 1, c2 = 1;
+  float squares = 0;
+  if (config.kind == Optimizer::Adam || config.kind == Optimizer::AdamW) {
+    c1 = 1 / (1 - std::pow(b1, (float) t));
+    c2 = 1 / (1 - std::pow(b2, (float) t));
+    if (config.kind == Optimizer::AdamW) shrink *= 1 - lr*decay;
+  }
+  for (Eigen::Index i = 0; i < n; i += OPTIMIZER_CHUNK) {
+    Eigen::Index len = std::min<Eigen::Index>(OPTIMIZER_CHUNK, n - i);
+    ArrayMap W (w + i, len);
+    ConstArrayMap G (g + i, len);
+    switch (config.kind) {
+    case Optimizer::SGD:
+      W = shrink*W - lr*G;
+      break;
+    case Optimizer::Momentum: {
+      ArrayMap M (m + i, len);
+      M = b1*M - lr*G;
+      W = shrink*W + M;
+      break;
+    }
+    case Optimizer::Nesterov: {
+      ArrayMap M (m + i, len);
+      M = b1*M - lr*G;
+      W = shrink*W + b1*M - lr*G;
+      break;
+    }
+    case Optimizer::Adam:
+    case Optimizer::AdamW: {
+      ArrayMap M (m + i, len);
+      ArrayMap S (s + i, len);
+      if (l2 != 0) {
+        M = b1*M + (1-b1)*(G + l2*W);
+        S = b2*S + (1-b2)*(G + l2*W).square();
+      }
+      else {
+        M = b1*M + (1-b1)*G;
+        S = b2*S + (1-b2)*G.square();
+      }
+      W = shrink*W - lr*(c1*M) / ((c2*S).sqrt() + eps);
+      break;
+    }
+    case Optimizer::RMSProp: {
+      ArrayMap S (s + i, len);
+      S = b2*S + (1-b2)*G.square();
+      W = shrink*W - lr*G / (S.sqrt() + eps);
+      break;
+    }
+    }
+    squares += W.square().sum();
+  }
+  return squares;
+}
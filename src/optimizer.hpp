@@ -0,0 +1,29 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include <Eigen/Dense>
+
+enum class Optimizer { SGD, Momentum, Nesterov, Adam, AdamW, RMSProp };
+
+// Hyperparameters shared by every optimizer. beta1 is the momentum coefficient for Momentum and
+// Nesterov and the first-moment decay for Adam/AdamW; beta2 is the second-moment decay for
+// Adam/AdamW and the squared-gradient decay for RMSProp.
+struct OptimizerConfig {
+  Optimizer kind = Optimizer::SGD;
+  float beta1 = 0.9f;
+  float beta2 = 0.999f;
+  float epsilon = 1e-8f;
+};
+
+// One update of n parameters w from their gradient g, in place. m and s are the optimizer's first
+// and second moment buffers for w (unused ones may be null). shrink multiplies the weights before
+// the step (the L2 decay SGD has always applied), decay is AdamW's decoupled weight decay and
+// l2 the penalty Adam adds to the gradient. t counts updates from 1, for Adam's bias correction.
+// Returns the sum of the squares of the updated w, taken on the way so the L2 penalty of the cost
+// never needs a pass of its own.
+float apply_update(const OptimizerConfig& config, float* w, float* m, float* s, const float* g, Eigen::Index n,
+                  float lr, float shrink, float decay, float l2, long t);
+bool second_moment(Optimizer kind);
+Optimizer optimizer_kind(const char* name);
+
+#endif /* OPTIMIZER_H */
@@ -0,0 +1,70 @@
+#include "pipeline.hpp"
+
+BatchPipeline::BatchPipeline(int depth, int batch_size, int inputs, int outputs)
+{
+  for (int i = 0; i < depth; i++) {
+    Batch batch;
+    batch.inputs = new Eigen::MatrixXf (batch_size, inputs);
+    batch.labels = new Eigen::MatrixXf (batch_size, outputs);
+    batch.inputs->setZero();
+    batch.labels->setZero();
+    slots.push_back(batch);
+  }
+}
+
+BatchPipeline::~BatchPipeline()
+{
+  stop();
+  for (Batch& batch : slots) {
+    delete batch.inputs;
+    delete batch.labels;
+  }
+}
+
+// Starts a producer thread that calls fill(slot, k) for batches k = 0..batches-1 in order,
+// staying at most `depth` batches ahead of the consumer.
+void BatchPipeline::start(std::function<void(Batch&, int)> fill, int batches)
+{
+  stop();
+  head.store(0);
+  tail.store(0);
+  cancelled.store(false);
+  producer = std::thread([this, fill, batches]() {
+    long depth = slots.size();
+    for (long k = 0; k < batches; k++) {
+      while (k - tail.load(std::memory_order_acquire) >= depth) {
+        if (cancelled.load(std::memory_order_relaxed)) return;
+        std::this_thread::yield();
+      }
+      fill(slots[k % depth], k);
+      head.store(k+1, std::memory_order_release);
+    }
+  });
+}
+
+// Joins the producer. Batches it filled that were never acquired are dropped.
+void BatchPipeline::stop()
+{
+  cancelled.store(true);
+  if (producer.joinable()) producer.join();
+}
+
+bool BatchPipeline::running()
+{
+  return producer.joinable();
+}
+
+// Waits for the next filled batch. The caller swaps its buffers in and then calls release().
+Batch& BatchPipeline::acquire()
+{
+  long k = tail.load(std::memory_order_relaxed);
+  while (head.load(std::memory_order_acquire) <= k) {
+    std::this_thread::yield();
+  }
+  return slots[k % slots.size()];
+}
+
+void BatchPipeline::release()
+{
+  tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
@@ -0,0 +1,39 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <Eigen/Dense>
+
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <vector>
+
+// One preallocated batch: the input rows and their labels.
+struct Batch {
+  Eigen::MatrixXf* inputs;
+  Eigen::MatrixXf* labels;
+};
+
+// Lock-free single-producer/single-consumer ring of preallocated batches. A producer thread fills
+// slots ahead of the training loop. The consumer swaps a filled slot's buffers with the ones the
+// network is holding and hands its old buffers back through the same slot, so no batch is ever copied
+// on the consumer side.
+class BatchPipeline {
+public:
+  BatchPipeline(int depth, int batch_size, int inputs, int outputs);
+  ~BatchPipeline();
+  void start(std::function<void(Batch&, int)> fill, int batches);
+  void stop();
+  bool running();
+  Batch& acquire();
+  void release();
+
+private:
+  std::vector<Batch> slots;
+  alignas(64) std::atomic<long> head {0}; // next slot the producer fills
+  alignas(64) std::atomic<long> tail {0}; // next slot the consumer takes
+  alignas(64) std::atomic<bool> cancelled {false};
+  std::thread producer;
+};
+
+#endif /* PIPELINE_H */
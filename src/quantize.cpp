@@ -0,0 +1,155 @@
+#include "quantize.hpp"
+#include "kernels.hpp"
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+static int padded_stride(int n)
+{
+  return (n + QUANT_ALIGN - 1) / QUANT_ALIGN * QUANT_ALIGN;
+}
+
+QuantizedNetwork::QuantizedNetwork(Network& net)
+{
+  inputs = net.layers[0].contents->cols();
+  input_kind = net.layers[0].activation_kind;
+  input_activation = net.layers[0].activation;
+  layers.resize(net.length-1);
+  for (int i = 0; i < net.length-1; i++) {
+    QuantizedLayer& q = layers[i];
+    const ParamMap& w = *net.layers[i].weights;
+    q.inputs = w.rows();
+    q.outputs = w.cols();
+    q.stride = padded_stride(q.inputs);
+    q.weights = (int8_t*) aligned_alloc(QUANT_ALIGN, (size_t)q.outputs * q.stride);
+    std::memset(q.weights, 0, (size_t)q.outputs * q.stride);
+    q.scales.resize(q.outputs);
+    q.colsums.resize(q.outputs);
+    for (int o = 0; o < q.outputs; o++) {
+      float max = w.col(o).cwiseAbs().maxCoeff();
+      float scale = max > 0 ? max / 127 : 1;
+      int32_t sum = 0;
+      for (int j = 0; j < q.inputs; j++) {
+        int8_t v = (int8_t) std::lrint(std::fmax(-127.0f, std::fmin(127.0f, w(j, o) / scale)));
+        q.weights[(size_t)o * q.stride + j] = v;
+        sum += v;
+      }
+      q.scales[o] = scale;
+      q.colsums[o] = sum;
+    }
+    const ParamMap& b = *net.layers[i+1].bias;
+    q.bias.assign(b.data(), b.data() + q.outputs);
+    q.activation_kind = net.layers[i+1].activation_kind;
+    q.activation = net.layers[i+1].activation;
+  }
+}
+
+QuantizedNetwork::~QuantizedNetwork()
+{
+  for (QuantizedLayer& q : layers) free(q.weights);
+}
+
+int QuantizedNetwork::classes()
+{
+  return layers.back().outputs;
+}
+
+size_t QuantizedNetwork::weight_bytes()
+{
+  size_t total = 0;
+  for (QuantizedLayer& q : layers) total += (size_t)q.outputs * q.stride;
+  return total;
+}
+
+// Symmetric per-row quantization of an n x cols row-major block into `quantized`, one scale per
+// row in `row_scales`. The padding past cols stays zero.
+void QuantizedNetwork::quantize_rows(const float* x, int n, int cols, int stride)
+{
+  quantized.assign((size_t)n * stride, 0);
+  row_scales.resize(n);
+  for (int r = 0; r < n; r++) {
+    row_scales[r] = kernels->quantize_row(x + (size_t)r * cols, cols, quantized.data() + (size_t)r * stride);
+  }
+}
+
+// Class probabilities for n row-major input rows, written row-major into out (n x classes()).
+void QuantizedNetwork::predict(const float* rows, int n, float* out)
+{
+  int widest = inputs;
+  for (QuantizedLayer& q : layers) widest = std::max(widest, q.outputs);
+  values.resize((size_t)n * widest);
+  std::copy(rows, rows + (size_t)n * inputs, values.data());
+  apply_activation(input_kind, input_activation, values.data(), (Eigen::Index)n * inputs);
+  for (int i = 0; i < (int) layers.size(); i++) {
+    QuantizedLayer& q = layers[i];
+    quantize_rows(values.data(), n, q.inputs, q.stride);
+    float* z = i == (int) layers.size()-1 ? out : values.data();
+    for (int r = 0; r < n; r++) {
+      const int8_t* x = quantized.data() + (size_t)r * q.stride;
+      float* dst = z + (size_t)r * q.outputs;
+      for (int o = 0; o < q.outputs; o++) {
+        int32_t acc = kernels->dot_i8(x, q.weights + (size_t)o * q.stride, q.stride, q.colsums[o]);
+        dst[o] = acc * row_scales[r] * q.scales[o] + q.bias[o];
+      }
+    }
+    apply_activation(q.activation_kind, q.activation, z, (Eigen::Index)n * q.outputs);
+  }
+  int k = classes();
+  float sum = kernels->softmax(out, n, k, k, 1);
+  checknan(sum, "sum in quantized Softmax operation");
+}
+
+// Runs every validation row through both the fp32 network and its quantized copy, batch_size rows
+// at a time; the last batch holds whatever is left over, and the means are over rows. The fp32 pass
+// goes through feedforward(), so it overwrites the network's activations and leaves it on batches
+// of batch_size rows.
+QuantizationReport quantization_report(Network& net, QuantizedNetwork& quantized)
+{
+  int batch = net.batch_size;
+  int classes = quantized.classes();
+  RowMatrixXf raw (batch, quantized.inputs);
+  RowMatrixXf probs (batch, classes);
+  Eigen::MatrixXf q_buffer (batch, classes);
+  QuantizationReport report = {0, 0, 0, 0, 0, 0};
+  int agree = 0;
+  int total = (net.test_instances + batch - 1) / batch;
+  for (int k = 0; k < total; k++) {
+    int n = std::min(batch, net.test_instances - k*batch);
+    net.use_rows(n);
+    Eigen::Map<Eigen::MatrixXf> in = net.layers[0].batch();
+    net.load_rows(net.test_rows.data() + k*batch, n, in, *net.labels);
+    Eigen::Map<RowMatrixXf> (raw.data(), n, quantized.inputs) = in;
+    net.feedforward();
+    Eigen::Map<Eigen::MatrixXf> fp_out = net.layers[net.length-1].batch();
+    report.fp32_cost += n * net.cross_entropy(fp_out, *net.labels);
+    report.fp32_acc += n * net.accuracy(fp_out, *net.labels);
+    quantized.predict(raw.data(), n, probs.data());
+    Eigen::Map<Eigen::MatrixXf> q_out (q_buffer.data(), n, classes);
+    q_out = Eigen::Map<RowMatrixXf> (probs.data(), n, classes);
+    report.int8_cost += n * net.cross_entropy(q_out, *net.labels);
+    report.int8_acc += n * net.accuracy(q_out, *net.labels);
+    for (int r = 0; r < n; r++) {
+      Eigen::Index a, b;
+      fp_out.row(r).maxCoeff(&a);
+      q_out.row(r).maxCoeff(&b);
+      agree += a == b;
+    }
+  }
+  net.use_rows(batch);
+  report.rows = net.test_instances;
+  if (report.rows > 0) {
+    report.fp32_cost /= report.rows;
+    report.fp32_acc /= report.rows;
+    report.int8_cost /= report.rows;
+    report.int8_acc /= report.rows;
+    report.agreement = (float) agree / report.rows;
+  }
+  return report;
+}
+
+// The int8 dot product in use: that of the kernel table picked for this CPU.
+const char* dot_kernel()
+{
+  return kernels->name;
+}
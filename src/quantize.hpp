@@ -0,0 +1,66 @@
+#ifndef QUANTIZE_H
+#define QUANTIZE_H
+
+#include "bpnn.hpp"
+
+#include <cstdint>
+#include <vector>
+
+#define QUANT_ALIGN 64 // int8 rows are padded to a multiple of this many bytes
+
+// One layer of a post-training quantized network. The weights feeding this layer are stored
+// transposed, one int8 row per output node, each with its own scale (max |w| / 127), so an output
+// is one contiguous int8 dot product. colsums holds the sum of each quantized row, which the
+// AVX-512 VNNI kernel needs to undo the +128 bias it adds to make the activations unsigned.
+struct QuantizedLayer {
+  int inputs;
+  int outputs;
+  int stride; // bytes per weight row, inputs rounded up to QUANT_ALIGN
+  int8_t* weights = nullptr;
+  std::vector<float> scales;
+  std::vector<int32_t> colsums;
+  std::vector<float> bias;
+  Activation activation_kind;
+  std::function<float(float)> activation;
+};
+
+// Accuracy and cross-entropy of a network and its quantized copy on the same validation rows.
+struct QuantizationReport {
+  int rows;
+  float fp32_acc;
+  float fp32_cost;
+  float int8_acc;
+  float int8_cost;
+  float agreement; // fraction of rows where both pick the same class
+};
+
+// Inference-only int8 copy of a trained Network. Inputs and hidden activations are quantized per
+// row on the fly; weights are quantized once per output column when the copy is made. Products
+// accumulate in int32 and are rescaled to fp32 for the bias, the activation and the final softmax.
+// Scratch buffers are members, so one QuantizedNetwork serves one thread at a time.
+class QuantizedNetwork {
+public:
+  int inputs;
+  std::vector<QuantizedLayer> layers; // layers[i] produces the activations of network layer i+1
+  Activation input_kind;
+  std::function<float(float)> input_activation;
+
+  QuantizedNetwork(Network& net);
+  ~QuantizedNetwork();
+  QuantizedNetwork(const QuantizedNetwork&) = delete; // the destructor frees the layers' weights
+  QuantizedNetwork& operator=(const QuantizedNetwork&) = delete;
+  void predict(const float* rows, int n, float* out);
+  int classes();
+  size_t weight_bytes();
+
+private:
+  std::vector<float> values;
+  std::vector<int8_t> quantized;
+  std::vector<float> row_scales;
+  void quantize_rows(const float* x, int n, int cols, int stride);
+};
+
+QuantizationReport quantization_report(Network& net, QuantizedNetwork& quantized);
+const char* dot_kernel();
+
+#endif /* QUANTIZE_H */
@@ -0,0 +1,118 @@
+#include "snapshot.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <stdexcept>
+#include <typeinfo>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// An unnamed file in memory: a memfd on Linux, elsewhere a POSIX shared memory object that is
+// unlinked as soon as it is opened.
+static int memory_file()
+{
+#ifdef __linux__
+  return memfd_create("jacobian-snapshot", MFD_CLOEXEC);
+#else
+  static std::atomic<long> counter {0};
+  char name[64];
+  snprintf(name, sizeof(name), "/jacobian-%d-%ld", (int) getpid(), counter++);
+  int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd != -1) shm_unlink(name);
+  return fd;
+#endif
+}
+
+Snapshot::Snapshot(const Network& net)
+  :size{net.params.size}, mirrors{net.params.mirrors}, steps{net.steps}, weight_norm{net.weight_norm}
+{
+  size_t page = sysconf(_SC_PAGESIZE);
+  bytes = (mirrors * size * sizeof(float) + page - 1) / page * page;
+  fd = memory_file();
+  if (fd == -1) throw std::runtime_error("Unable to create a snapshot file!");
+  if (ftruncate(fd, bytes) != 0) {
+    close(fd);
+    throw std::runtime_error("Unable to size a snapshot file!");
+  }
+  void* image = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (image == MAP_FAILED) {
+    close(fd);
+    throw std::runtime_error("Unable to map a snapshot file!");
+  }
+  std::copy(net.params.arena, net.params.arena + mirrors * size, (float*) image);
+  munmap(image, bytes);
+}
+
+Snapshot::~Snapshot()
+{
+  close(fd);
+}
+
+// A private, writable mapping of the snapshot: reads come from the shared pages, and the first
+// write to a page gives the writer its own copy of it.
+float* Snapshot::map(size_t& length) const
+{
+  void* pages = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if (pages == MAP_FAILED) throw std::runtime_error("Unable to map a snapshot file!");
+  length = bytes;
+  return (float*) pages;
+}
+
+// Freezes the current parameters and optimizer state, to fork from.
+Snapshot* Network::snapshot()
+{
+  return new Snapshot (*this);
+}
+
+// The fork constructor: `parent`'s topology, hyperparameters, schedules, split, RNG and counters,
+// with the parameters and optimizer state of `from`, mapped copy-on-write. Batch buffers and the
+// workspace are the fork's own, and it starts without worker threads, prefetching or a validator.
+Network::Network(const Network& parent, const Snapshot& from)
+  :data{parent.data}, dataset_rows{parent.dataset_rows}, train_rows{parent.train_rows},
+   test_rows{parent.test_rows}, cursor{parent.cursor}, instances{parent.instances},
+   test_instances{parent.test_instances}, ratio{parent.ratio}, shuffle_chunk{parent.shuffle_chunk},
+   rng{parent.rng}, prefetch_depth{parent.prefetch_depth}, micro_batches{parent.micro_batches},
+   members{parent.members}, layers{parent.layers}, length{parent.length},
+   epoch_acc{parent.epoch_acc}, epoch_cost{parent.epoch_cost}, val_acc{parent.val_acc},
+   val_cost{parent.val_cost}, validation_batch{parent.validation_batch},
+   background_validation{parent.background_validation}, learning_rate{parent.learning_rate},
+   bias_lr{parent.bias_lr}, lambda{parent.lambda}, batch_size{parent.batch_size},
+   max_batch{parent.max_batch}, batch_rows{parent.batch_rows}, batch_growth{parent.batch_growth},
+   growth_every{parent.growth_every}, largest_batch{parent.largest_batch}, epochs{parent.epochs},
+   batches{parent.batches}, labels{new Eigen::MatrixXf (*parent.labels)}, params{parent.params},
+   stats{parent.stats}, weight_norm{from.weight_norm}, decay{parent.decay}, decay_a0{parent.decay_a0},
+   decay_k{parent.decay_k}, optimizer{parent.optimizer}, steps{from.steps}, verbose{parent.verbose}
+{
+  std::copy(parent.decay_type, parent.decay_type + sizeof(decay_type), decay_type);
+  for (Layer& layer : layers) {
+    layer.contents = new Eigen::MatrixXf (*layer.contents);
+    layer.dZ = new Eigen::MatrixXf (*layer.dZ);
+  }
+  params.arena = from.map(params.mapped);
+  params.place(layers);
+  workspace.plan(layers, max_batch);
+  use_rows(batch_rows);
+}
+
+// An independent network with the parameters and optimizer state of `from` (see the fork
+// constructor). The data is shared, so this network's dataset has to outlive the fork. Only plain
+// Networks fork: a subclass's own state would not be copied.
+Network* Network::fork(const Snapshot& from)
+{
+  if (typeid(*this) != typeid(Network)) {
+    throw std::runtime_error("Only a plain Network can be forked!");
+  }
+  if (from.size != params.size || from.mirrors != params.mirrors) {
+    throw std::invalid_argument("Snapshot was taken of a different network!");
+  }
+  return new Network (*this, from);
+}
+
+// Snapshots this network and forks it once. To branch many times, fork repeatedly from one
+// snapshot() instead, so the branches share its pages.
+Network* Network::fork()
+{
+  Snapshot from (*this);
+  return fork(from);
+}
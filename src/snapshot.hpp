@@ -0,0 +1,29 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "bpnn.hpp"
+
+#include <cstddef>
+
+// A frozen copy of a network's Parameters (values and optimizer state) in an anonymous memory
+// file. Taking one costs a single copy of the parameters. Every fork made from it maps the file
+// privately, so forks share its pages, and a fork that trains only copies the pages it writes.
+// The file stays alive as long as a fork maps it, so the Snapshot itself can go right away.
+class Snapshot {
+public:
+  Eigen::Index size; // floats per mirror, as in Parameters
+  int mirrors;
+  long steps; // optimizer steps taken when the snapshot was taken
+  float weight_norm;
+
+  Snapshot(const Network& net);
+  ~Snapshot();
+  Snapshot(const Snapshot&) = delete;
+  float* map(size_t& length) const;
+
+private:
+  int fd;
+  size_t bytes;
+};
+
+#endif /* SNAPSHOT_H */
@@ -0,0 +1,208 @@
+#include "sparse.hpp"
+#include "trace.hpp"
+#include "validation.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+// Reads a libsvm file: one row per line, `label index:value index:value ...`, with 1-based indices
+// below or equal to `inputs`. Blank lines are skipped.
+SparseDataset::SparseDataset(char* path, int inputs)
+  :inputs{inputs}
+{
+  FILE* rptr = fopen(path, "r");
+  if (rptr == NULL) throw std::runtime_error(std::string("Unable to open dataset `") + path + "`!");
+  owned_indptr.push_back(0);
+  char* line = NULL;
+  size_t capacity = 0;
+  while (getline(&line, &capacity, rptr) != -1) {
+    char* p = line;
+    char* end;
+    float label = strtof(p, &end);
+    if (end == p) continue;
+    p = end;
+    while (true) {
+      long index = strtol(p, &end, 10);
+      if (end == p || *end != ':') break;
+      if (index < 1 || index > inputs) {
+        free(line);
+        fclose(rptr);
+        throw std::runtime_error(std::string("Feature index out of range in `") + path + "`!");
+      }
+      p = end + 1;
+      owned_indices.push_back(index - 1);
+      owned_values.push_back(strtof(p, &end));
+      p = end;
+    }
+    owned_labels.push_back(label);
+    owned_indptr.push_back(owned_indices.size());
+  }
+  free(line);
+  fclose(rptr);
+  rows = owned_labels.size();
+  indptr = owned_indptr.data();
+  indices = owned_indices.data();
+  values = owned_values.data();
+  labels = owned_labels.data();
+}
+
+SparseDataset::SparseDataset(const int* indptr, const int* indices, const float* values, const float* labels, int rows, int inputs)
+  :rows{rows}, inputs{inputs}, indptr{indptr}, indices{indices}, values{values}, labels{labels}
+{
+}
+
+SparseNetwork::SparseNetwork(char* path, int inputs, int batch_sz, float learn_rate, float bias_rate, float l, float ratio)
+  :SparseNetwork(new SparseDataset (path, inputs), batch_sz, learn_rate, bias_rate, l, ratio)
+{
+  opened_sparse = sparse;
+}
+
+SparseNetwork::SparseNetwork(SparseDataset* dataset, int batch_sz, float learn_rate, float bias_rate, float l, float ratio)
+  :Network((Dataset*) nullptr, batch_sz, learn_rate, bias_rate, l, ratio), sparse{dataset}
+{
+  dataset_rows = sparse->rows;
+  split_rows();
+}
+
+SparseNetwork::~SparseNetwork()
+{
+  delete embedding;
+  delete opened_sparse;
+}
+
+// The first call declares the sparse input (its width must match the dataset's and its activation
+// must be linear, since anything else would turn the zeros into non-zeros). Later calls add dense
+// layers as usual.
+void SparseNetwork::add_layer(int nodes, char* activation)
+{
+  if (inputs == 0) {
+    if (nodes != sparse->inputs) throw std::invalid_argument("Sparse input layer width does not match the dataset");
+    if (strcmp(activation, "linear") != 0) throw std::invalid_argument("Sparse input layer must be linear");
+    inputs = nodes;
+    return;
+  }
+  Network::add_layer(nodes, activation);
+}
+
+void SparseNetwork::initialize()
+{
+  Network::initialize();
+  int nodes = layers[0].contents->cols();
+  delete embedding;
+  embedding = new RowMatrixXf (inputs, nodes);
+  std::normal_distribution<float> d(0, sqrt(1.0/(inputs + nodes)));
+  for (Eigen::Index i = 0; i < embedding->size(); i++) embedding->data()[i] = d(rng);
+}
+
+// Gathers the CSR slices of `rows` into one CSR matrix. The buffers only grow, so after the first
+// few batches this no longer allocates.
+void SparseNetwork::gather(const int* rows, int n, std::vector<int>& indptr, std::vector<int>& indices, std::vector<float>& values)
+{
+  indptr.resize(n+1);
+  indices.clear();
+  values.clear();
+  indptr[0] = 0;
+  for (int i = 0; i < n; i++) {
+    int start = sparse->indptr[rows[i]];
+    int end = sparse->indptr[rows[i]+1];
+    indices.insert(indices.end(), sparse->indices + start, sparse->indices + end);
+    values.insert(values.end(), sparse->values + start, sparse->values + end);
+    indptr[i+1] = indices.size();
+  }
+}
+
+// Loads `rows` as the next batch: their CSR slices and their labels, on n rows of the buffers.
+void SparseNetwork::load_batch(const int* rows, int n)
+{
+  TRACE("load");
+  use_rows(n);
+  gather(rows, n, batch_indptr, batch_indices, batch_values);
+  for (int i = 0; i < n; i++) (*labels)(i, 0) = sparse->labels[rows[i]];
+}
+
+void SparseNetwork::feedforward()
+{
+  SparseBatch batch (batch_indptr.size()-1, inputs, batch_values.size(), batch_indptr.data(), batch_indices.data(), batch_values.data());
+  Eigen::Map<Eigen::MatrixXf> first = layers[0].batch();
+  {
+    TRACE("gemm", 0);
+    first.noalias() = batch * (*embedding);
+    first.rowwise() += layers[0].bias->row(0);
+  }
+  forward_pass(layers, *labels, &workspace, &stats);
+}
+
+// The dense layers are trained as in Network::backpropagate. The error is then carried one step
+// further, into layers[0], and only the embedding rows named in the batch are updated.
+void SparseNetwork::backpropagate()
+{
+  Eigen::Map<Eigen::MatrixXf>& error = workspace.gradients[length-1]; // already the output error if length is 1
+  if (length > 1) {
+    compute_gradients(layers, workspace);
+    error.noalias() = workspace.gradients[length-2] * layers[0].weights->transpose();
+    error.array() *= layers[0].batch_dZ().array();
+    weight_norm = apply_gradients(workspace, batch_rows);
+  }
+  checknan(error.sum(), "gradient of sparse input layer");
+  TRACE("update", 0);
+  layers[0].bias->row(0).noalias() -= bias_lr * error.colwise().sum();
+  for (int r = 0; r < (int) batch_indptr.size()-1; r++) {
+    for (int k = batch_indptr[r]; k < batch_indptr[r+1]; k++) {
+      embedding->row(batch_indices[k]).noalias() -= (learning_rate * batch_values[k]) * error.row(r);
+    }
+  }
+}
+
+// Scores the whole validation split through the Validator, as Network::test does. Its input is
+// layers[0] before activation, i.e. the validation rows times the embedding plus the bias, which
+// is recomputed every time since the embedding keeps training. The CSR rows of the split are
+// gathered once, with the validator.
+float SparseNetwork::test()
+{
+  if (validator == nullptr) {
+    validator = new Validator (layers, params, validation_batch);
+    validator->labels.resize(test_instances, 1);
+    for (int i = 0; i < test_instances; i++) validator->labels(i, 0) = sparse->labels[test_rows[i]];
+    gather(test_rows.data(), test_instances, test_indptr, test_indices, test_values);
+  }
+  {
+    TRACE("gemm", 0);
+    SparseBatch split (test_instances, inputs, test_values.size(), test_indptr.data(), test_indices.data(), test_values.data());
+    validator->features.noalias() = split * (*embedding);
+    validator->features.rowwise() += layers[0].bias->row(0);
+  }
+  validator->run(params.arena);
+  val_acc = validator->accuracy;
+  val_cost = validator->loss + 0.5f*lambda*weight_norm;
+  return 0;
+}
+
+// One epoch over every training row; the last batch holds whatever is left over, and the sums are
+// over rows so that batch counts for its size.
+void SparseNetwork::train()
+{
+  TRACE("epoch");
+  shuffle_rows();
+  float cost_sum = 0;
+  float acc_sum = 0;
+  int total = (instances + batch_size - 1) / batch_size;
+  for (int k = 0; k < total; k++) {
+    int n = std::min(batch_size, instances - k*batch_size);
+    load_batch(train_rows.data() + k*batch_size, n);
+    feedforward();
+    backpropagate();
+    cost_sum += n * cost();
+    acc_sum += n * accuracy();
+    batches++;
+  }
+  epoch_acc = acc_sum / instances;
+  epoch_cost = cost_sum / instances;
+  test();
+  if (verbose) printf("Epoch %i complete - cost %f - acc %f - val_cost %f - val_acc %f\n", epochs, epoch_cost, epoch_acc, val_cost, val_acc);
+  batches=1;
+  learning_rate = decay(learning_rate, epochs);
+  epochs++;
+}
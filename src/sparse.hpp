@@ -0,0 +1,71 @@
+#ifndef SPARSE_H
+#define SPARSE_H
+
+#include "bpnn.hpp"
+
+#include <Eigen/SparseCore>
+
+#include <vector>
+
+typedef Eigen::Map<const Eigen::SparseMatrix<float, Eigen::RowMajor>> SparseBatch;
+
+// Rows of very wide, mostly-zero features in CSR form (indptr/indices/values, as in scipy.sparse)
+// plus one class label per row. Either parsed from a libsvm file or borrowed from caller-owned
+// arrays, which must then outlive the dataset.
+class SparseDataset {
+public:
+  int rows;
+  int inputs;
+  const int* indptr;
+  const int* indices;
+  const float* values;
+  const float* labels;
+
+  SparseDataset(char* path, int inputs);
+  SparseDataset(const int* indptr, const int* indices, const float* values, const float* labels, int rows, int inputs);
+
+private:
+  std::vector<int> owned_indptr;
+  std::vector<int> owned_indices;
+  std::vector<float> owned_values;
+  std::vector<float> owned_labels;
+};
+
+// A network whose input layer is sparse. The first add_layer call only sets the input width; no
+// dense input layer is ever allocated. The first weight matrix is a row-major `inputs x nodes`
+// table. The forward pass multiplies it by the CSR batch, and the backward pass updates only the
+// rows of that table the batch touched. Every layer after the input is an ordinary dense layer
+// in `layers`, trained by the usual optimizer. Memory and work for the input therefore scale with
+// the number of non-zeros, not with the input width.
+//
+// The input table gets plain SGD without L2 decay, since decaying every row each step would touch
+// all of them.
+class SparseNetwork : public Network {
+public:
+  SparseDataset* sparse;
+  SparseDataset* opened_sparse = nullptr; // parsed or wrapped by the network itself, so freed with it
+  int inputs = 0;
+  RowMatrixXf* embedding = nullptr; // weights from the sparse input to layers[0]
+
+  SparseNetwork(char* path, int inputs, int batch_sz, float learn_rate, float bias_rate, float l, float ratio);
+  SparseNetwork(SparseDataset* dataset, int batch_sz, float learn_rate, float bias_rate, float l, float ratio);
+  ~SparseNetwork();
+  void add_layer(int nodes, char* activation);
+  void initialize();
+  void load_batch(const int* rows, int n);
+  void feedforward();
+  void backpropagate();
+  float test();
+  void train();
+
+private:
+  std::vector<int> batch_indptr;
+  std::vector<int> batch_indices;
+  std::vector<float> batch_values;
+  std::vector<int> test_indptr; // the validation split, gathered with the validator
+  std::vector<int> test_indices;
+  std::vector<float> test_values;
+  void gather(const int* rows, int n, std::vector<int>& indptr, std::vector<int>& indices, std::vector<float>& values);
+};
+
+#endif /* SPARSE_H */
@@ -0,0 +1,169 @@
+#include "sweep.hpp"
+#include "utils.hpp"
+
+#include <atomic>
+#include <cmath>
+#include <chrono>
+#include <fstream>
+#include <stdexcept>
+
+// Used for any parameter the search space leaves out. Same as the defaults in scripts/example.py.
+static const std::map<std::string, std::string> SWEEP_DEFAULTS = {
+  {"batch_size", "10"}, {"hidden_layers", "1"}, {"epochs", "50"}, {"learning_rate", "0.0155"},
+  {"bias_lr", "0.03"}, {"activation", "lecun_tanh"}, {"neurons", "10"}, {"l", "0"}
+};
+
+Sweep::Sweep(char* path, float ratio)
+  :ratio{ratio}
+{
+  data = open_dataset(path);
+  classes = (int)data->labels(0, data->rows).maxCoeff() + 1;
+}
+
+Sweep::~Sweep()
+{
+  delete data;
+}
+
+void Sweep::add_parameter(std::string name, std::string distribution, double min, double max, std::vector<std::string> values)
+{
+  if (distribution != "int_uniform" && distribution != "uniform" && distribution != "categorical") {
+    throw std::runtime_error("Unknown distribution `" + distribution + "` for sweep parameter `" + name + "`!");
+  }
+  if (SWEEP_DEFAULTS.count(name) == 0) {
+    throw std::runtime_error("Unknown sweep parameter `" + name + "`!");
+  }
+  if (name == "activation") {
+    if (distribution != "categorical") throw std::runtime_error("Sweep parameter `activation` must be categorical!");
+    for (std::string& value : values) {
+      if (parse_activation(value.c_str()) == Activation::Custom) {
+        throw std::runtime_error("Unknown activation `" + value + "` for sweep parameter `activation`!");
+      }
+    }
+  }
+  parameters.push_back({name, distribution, min, max, values});
+}
+
+// Reads the `parameters:` block of a sweep.yaml. Only the subset the sweeps in scripts/ use is
+// understood: a name per parameter, then distribution/min/max keys or a `values:` list under it.
+void Sweep::load_config(char* path)
+{
+  std::ifstream file (path);
+  if (!file.is_open()) throw std::runtime_error(std::string("Unable to open sweep config `") + path + "`!");
+  auto trim = [](std::string s) -> std::string {
+    size_t first = s.find_first_not_of(" \t\r");
+    size_t last = s.find_last_not_of(" \t\r");
+    return first == std::string::npos ? "" : s.substr(first, last-first+1);
+  };
+  std::string line;
+  bool in_parameters = false;
+  int param_indent = -1;
+  std::vector<SweepParameter> parsed;
+  while (std::getline(file, line)) {
+    std::string content = trim(line);
+    if (content.empty() || content[0] == '#') continue;
+    int indent = line.find_first_not_of(" ");
+    if (indent == 0) {
+      in_parameters = content == "parameters:";
+      continue;
+    }
+    if (!in_parameters) continue;
+    if (param_indent == -1) param_indent = indent;
+    if (indent == param_indent) {
+      parsed.emplace_back();
+      parsed.back().name = trim(content.substr(0, content.find(':')));
+    }
+    else if (content[0] == '-') {
+      parsed.back().values.push_back(trim(content.substr(1)));
+    }
+    else {
+      std::string key = trim(content.substr(0, content.find(':')));
+      std::string value = trim(content.substr(content.find(':')+1));
+      if (key == "distribution") parsed.back().distribution = value;
+      else if (key == "min") parsed.back().min = strtod(value.c_str(), NULL);
+      else if (key == "max") parsed.back().max = strtod(value.c_str(), NULL);
+    }
+  }
+  for (SweepParameter& p : parsed) {
+    if (p.distribution.empty() && !p.values.empty()) p.distribution = "categorical";
+    add_parameter(p.name, p.distribution, p.min, p.max, p.values);
+  }
+}
+
+// Draws the configuration for one trial and trains it. The draw only depends on the sweep seed and
+// the trial index, so a sweep gives the same results whatever the thread count.
+SweepResult Sweep::trial(int index)
+{
+  std::mt19937 gen (seed * 1000003u + index);
+  std::map<std::string, std::string> config = SWEEP_DEFAULTS;
+  for (SweepParameter& p : parameters) {
+    if (p.distribution == "int_uniform") {
+      std::uniform_int_distribution<int> d ((int)p.min, (int)p.max);
+      config[p.name] = std::to_string(d(gen));
+    }
+    else if (p.distribution == "uniform") {
+      std::uniform_real_distribution<double> d (p.min, p.max);
+      config[p.name] = std::to_string(d(gen));
+    }
+    else {
+      std::uniform_int_distribution<int> d (0, p.values.size()-1);
+      config[p.name] = p.values[d(gen)];
+    }
+  }
+  auto start = std::chrono::high_resolution_clock::now();
+  auto elapsed = [&start]() -> double {
+    auto end = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / pow(10,9);
+  };
+  // A configuration the network rejects fails this trial only, not the whole sweep.
+  try {
+    Network net (data, std::stoi(config["batch_size"]), std::stof(config["learning_rate"]), std::stof(config["bias_lr"]), std::stof(config["l"]), ratio);
+    net.verbose = false;
+    net.seed(gen());
+    net.add_layer(data->inputs, (char*)"linear");
+    for (int i = 0; i < std::stoi(config["hidden_layers"]); i++) {
+      net.add_layer(std::stoi(config["neurons"]), (char*)config["activation"].c_str());
+    }
+    net.add_layer(classes, (char*)"linear");
+    net.initialize();
+    for (int i = 0; i < std::stoi(config["epochs"]); i++) {
+      net.train();
+    }
+    return {index, config, net.get_cost(), net.get_acc(), net.get_val_cost(), net.get_val_acc(), elapsed(), ""};
+  }
+  catch (const std::exception& e) {
+    return {index, config, NAN, NAN, NAN, NAN, elapsed(), e.what()};
+  }
+}
+
+// Runs `trials` trials on `threads` workers that pull trial indices off a shared counter.
+// Returns the results sorted by validation accuracy, best first.
+std::vector<SweepResult> Sweep::run(int trials, int threads)
+{
+  results.assign(trials, SweepResult());
+  std::atomic<int> next {0};
+  ThreadPool pool (std::max(1, std::min(threads, trials)));
+  pool.run([this, &next, trials](int) -> void {
+    for (int i = next++; i < trials; i = next++) {
+      results[i] = trial(i);
+    }
+  });
+  auto key = [](float acc) -> float {return std::isnan(acc) ? -INFINITY : acc;};
+  std::stable_sort(results.begin(), results.end(), [key](const SweepResult& a, const SweepResult& b) -> bool {
+    return key(a.val_acc) > key(b.val_acc);
+  });
+  return results;
+}
+
+void Sweep::print_results()
+{
+  printf("%-6s %-9s %-9s %-9s %-9s %-8s ", "trial", "val_acc", "val_cost", "acc", "cost", "time");
+  for (auto& entry : SWEEP_DEFAULTS) printf("%-14s ", entry.first.c_str());
+  printf("\n");
+  for (SweepResult& r : results) {
+    printf("%-6d %-9.4f %-9.4f %-9.4f %-9.4f %-8.3f ", r.trial, r.val_acc, r.val_cost, r.acc, r.cost, r.seconds);
+    for (auto& entry : r.config) printf("%-14s ", entry.second.c_str());
+    if (!r.error.empty()) printf("%s", r.error.c_str());
+    printf("\n");
+  }
+}
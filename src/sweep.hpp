@@ -0,0 +1,58 @@
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include "bpnn.hpp"
+
+#include <map>
+#include <string>
+#include <vector>
+
+// One hyperparameter of a sweep, in the same shape as an entry under `parameters:` in a W&B
+// sweep.yaml: `int_uniform` and `uniform` draw from [min, max], `categorical` picks one of `values`.
+struct SweepParameter {
+  std::string name;
+  std::string distribution;
+  double min = 0;
+  double max = 0;
+  std::vector<std::string> values;
+};
+
+// One finished trial: the configuration it drew and where its network ended up. A trial that threw
+// has NaN metrics and the exception's message in `error`.
+struct SweepResult {
+  int trial;
+  std::map<std::string, std::string> config;
+  float cost;
+  float acc;
+  float val_cost;
+  float val_acc;
+  double seconds;
+  std::string error;
+};
+
+// Local hyperparameter sweep. Trials are random draws from the search space, trained concurrently on
+// a thread pool. Every trial's Network reads the same memory-mapped copy of the dataset, and frees
+// its own buffers when the trial returns.
+//
+// Recognized parameters are batch_size, hidden_layers, neurons, activation, learning_rate, bias_lr,
+// l and epochs; the topology is inputs -> hidden_layers x neurons -> one output per class.
+class Sweep {
+public:
+  Dataset* data;
+  float ratio;
+  int classes;
+  unsigned int seed = 0;
+  std::vector<SweepParameter> parameters;
+  std::vector<SweepResult> results;
+
+  Sweep(char* path, float ratio);
+  ~Sweep();
+  Sweep(const Sweep&) = delete;
+  void add_parameter(std::string name, std::string distribution, double min, double max, std::vector<std::string> values);
+  void load_config(char* path);
+  std::vector<SweepResult> run(int trials, int threads);
+  SweepResult trial(int index);
+  void print_results();
+};
+
+#endif /* SWEEP_H */
@@ -0,0 +1,45 @@
+#include "threadpool.hpp"
+
+ThreadPool::ThreadPool(int threads)
+{
+  for (int i = 0; i < threads; i++) {
+    workers.emplace_back([this, i]() {
+      long seen = 0;
+      while (true) {
+        std::unique_lock<std::mutex> guard (lock);
+        wake.wait(guard, [this, seen]() {return stopping || generation != seen;});
+        if (stopping) return;
+        seen = generation;
+        guard.unlock();
+        task(i);
+        guard.lock();
+        if (--pending == 0) finished.notify_one();
+      }
+    });
+  }
+}
+
+ThreadPool::~ThreadPool()
+{
+  {
+    std::lock_guard<std::mutex> guard (lock);
+    stopping = true;
+  }
+  wake.notify_all();
+  for (std::thread& worker : workers) worker.join();
+}
+
+int ThreadPool::size()
+{
+  return workers.size();
+}
+
+void ThreadPool::run(std::function<void(int)> job)
+{
+  std::unique_lock<std::mutex> guard (lock);
+  task = std::move(job);
+  pending = workers.size();
+  generation++;
+  wake.notify_all();
+  finished.wait(guard, [this]() {return pending == 0;});
+}
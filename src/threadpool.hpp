@@ -0,0 +1,30 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent fork-join pool. run() hands the same task to every worker, each with its own index,
+// and returns once all of them have finished. Workers sleep between calls.
+class ThreadPool {
+public:
+  ThreadPool(int threads);
+  ~ThreadPool();
+  int size();
+  void run(std::function<void(int)> job);
+
+private:
+  std::vector<std::thread> workers;
+  std::mutex lock;
+  std::condition_variable wake;
+  std::condition_variable finished;
+  std::function<void(int)> task;
+  long generation = 0;
+  int pending = 0;
+  bool stopping = false;
+};
+
+#endif /* THREADPOOL_H */
@@ -0,0 +1,159 @@
+#include "trace.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+std::atomic<bool> tracing {false};
+
+// Ring buffer of one thread's events. Only the owning thread writes; readers take everything from
+// `cleared` (or the oldest surviving event) up to `head`. Buffers outlive their threads, so events
+// from finished pool workers and training jobs can still be dumped. When a thread exits its buffer
+// goes on a free list and the next new thread carries on writing into it under the same tid, so
+// memory grows with the most threads traced at once, not with every thread ever started.
+struct ThreadTrace {
+  int tid;
+  std::atomic<uint64_t> head {0};
+  std::atomic<uint64_t> cleared {0};
+  TraceEvent events[TRACE_CAPACITY];
+};
+
+static std::mutex registry_lock;
+static std::vector<std::shared_ptr<ThreadTrace>> registry;
+static std::vector<std::shared_ptr<ThreadTrace>> idle; // buffers of threads that have exited
+
+// A thread's hold on its buffer, handed back to `idle` when the thread exits.
+struct LocalTrace {
+  std::shared_ptr<ThreadTrace> trace;
+
+  LocalTrace()
+  {
+    std::lock_guard<std::mutex> guard (registry_lock);
+    if (!idle.empty()) {
+      trace = idle.back();
+      idle.pop_back();
+      return;
+    }
+    trace = std::make_shared<ThreadTrace>();
+    trace->tid = registry.size();
+    registry.push_back(trace);
+  }
+  ~LocalTrace()
+  {
+    std::lock_guard<std::mutex> guard (registry_lock);
+    idle.push_back(trace);
+  }
+};
+
+static ThreadTrace& local_trace()
+{
+  thread_local LocalTrace local;
+  return *local.trace;
+}
+
+int64_t trace_clock()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void trace_record(const char* name, int arg, int64_t start, int64_t end)
+{
+  ThreadTrace& trace = local_trace();
+  uint64_t head = trace.head.load(std::memory_order_relaxed);
+  trace.events[head % TRACE_CAPACITY] = {name, arg, start, end - start};
+  trace.head.store(head + 1, std::memory_order_release);
+}
+
+void trace_enable()
+{
+  tracing.store(true, std::memory_order_relaxed);
+}
+
+void trace_disable()
+{
+  tracing.store(false, std::memory_order_relaxed);
+}
+
+void trace_clear()
+{
+  std::lock_guard<std::mutex> guard (registry_lock);
+  for (std::shared_ptr<ThreadTrace>& trace : registry) {
+    trace->cleared.store(trace->head.load(std::memory_order_acquire), std::memory_order_relaxed);
+  }
+}
+
+// Every thread's surviving events, paired with the thread's id. Meant to be called with tracing
+// disabled, or at least while no traced code is running.
+static std::vector<std::pair<int, TraceEvent>> collect()
+{
+  std::vector<std::pair<int, TraceEvent>> events;
+  std::lock_guard<std::mutex> guard (registry_lock);
+  for (std::shared_ptr<ThreadTrace>& trace : registry) {
+    uint64_t head = trace->head.load(std::memory_order_acquire);
+    uint64_t first = std::max(trace->cleared.load(std::memory_order_relaxed), head > TRACE_CAPACITY ? head - TRACE_CAPACITY : 0);
+    for (uint64_t i = first; i < head; i++) events.emplace_back(trace->tid, trace->events[i % TRACE_CAPACITY]);
+  }
+  return events;
+}
+
+// Writes the events in Chrome's trace event format (chrome://tracing, Perfetto): one complete
+// ("X") event per scope, in microseconds from the earliest event, one track per thread.
+void trace_dump(const char* path)
+{
+  std::vector<std::pair<int, TraceEvent>> events = collect();
+  int64_t origin = INT64_MAX;
+  for (auto& e : events) origin = std::min(origin, e.second.start);
+  FILE* f = fopen(path, "w");
+  if (f == NULL) throw std::runtime_error(std::string("Unable to write trace `") + path + "`!");
+  fprintf(f, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+  for (size_t i = 0; i < events.size(); i++) {
+    const TraceEvent& e = events[i].second;
+    fprintf(f, "%s\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 0, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f",
+            i == 0 ? "" : ",", e.name, events[i].first, (e.start - origin) / 1e3, e.duration / 1e3);
+    if (e.arg >= 0) fprintf(f, ", \"args\": {\"layer\": %d}", e.arg);
+    fprintf(f, "}");
+  }
+  fprintf(f, "\n]}\n");
+  fclose(f);
+}
+
+// One row per phase (and layer, for per-layer phases), busiest first: calls, total time, mean,
+// minimum and maximum.
+std::string trace_summary()
+{
+  struct Row {
+    long count = 0;
+    int64_t total = 0;
+    int64_t min = INT64_MAX;
+    int64_t max = 0;
+  };
+  std::map<std::pair<std::string, int>, Row> rows;
+  for (auto& e : collect()) {
+    Row& row = rows[{e.second.name, e.second.arg}];
+    row.count++;
+    row.total += e.second.duration;
+    row.min = std::min(row.min, e.second.duration);
+    row.max = std::max(row.max, e.second.duration);
+  }
+  std::vector<std::pair<std::pair<std::string, int>, Row>> sorted (rows.begin(), rows.end());
+  std::sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) {return a.second.total > b.second.total;});
+  std::string out;
+  char line[160];
+  snprintf(line, sizeof(line), "%-16s %6s %10s %12s %12s %12s %12s\n", "phase", "layer", "calls", "total ms", "mean us", "min us", "max us");
+  out += line;
+  for (auto& r : sorted) {
+    char layer[16] = "-";
+    if (r.first.second >= 0) snprintf(layer, sizeof(layer), "%d", r.first.second);
+    const Row& row = r.second;
+    snprintf(line, sizeof(line), "%-16s %6s %10ld %12.3f %12.3f %12.3f %12.3f\n", r.first.first.c_str(), layer, row.count,
+             row.total / 1e6, row.total / 1e3 / row.count, row.min / 1e3, row.max / 1e3);
+    out += line;
+  }
+  return out;
+}
@@ -0,0 +1,53 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#define TRACE_CAPACITY 65536 // events kept per thread; older ones are overwritten
+
+// One finished scope: what ran, an optional argument (the layer, for per-layer phases; -1
+// otherwise), and when, in nanoseconds on the steady clock.
+struct TraceEvent {
+  const char* name;
+  int arg;
+  int64_t start;
+  int64_t duration;
+};
+
+extern std::atomic<bool> tracing;
+
+int64_t trace_clock();
+void trace_record(const char* name, int arg, int64_t start, int64_t end);
+
+// Times the enclosing scope into the calling thread's ring buffer. While tracing is off a scope
+// costs one relaxed load.
+class TraceScope {
+public:
+  TraceScope(const char* name, int arg = -1)
+    :name{name}, arg{arg}, start{tracing.load(std::memory_order_relaxed) ? trace_clock() : -1}
+  {
+  }
+  ~TraceScope()
+  {
+    if (start >= 0) trace_record(name, arg, start, trace_clock());
+  }
+
+private:
+  const char* name;
+  int arg;
+  int64_t start;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE(...) TraceScope TRACE_CONCAT(trace_scope_, __LINE__) (__VA_ARGS__)
+
+void trace_enable();
+void trace_disable();
+void trace_clear();
+void trace_dump(const char* path);
+std::string trace_summary();
+
+#endif /* TRACE_H */
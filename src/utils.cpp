@@ -4,34 +4,40 @@
 #include <ctime>
 #include <cmath>
 #include <cstdio>
+#include <cstring>
+#include <algorithm>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/stat.h>
 #include <Eigen/Dense>
 
+#include "utils.hpp"
+#include "kernels.hpp"
+
 // A bunch of hardcoded activation functions. Avoids much of the slowness of custom functions.
-// Although the std::function makes it not the fastest way, the functionality is worth it.
+// The scalar versions are only used for layers whose activation was overwritten with set_activation,
+// the built-in ones go through the vectorized kernels in apply_activation below.
 // Yes, these functions may be a frustrating to read but they're just equations and I want to conserve space.
 
 //float tanhapprox(float x) {return x - (1/3 * pow(x, 3)) + (2/15 * pow(x, 5)) - (17/315 * pow(x, 7));}
 
-float sigmoid(float x) {return 1.0/(1+exp(-x));}
-float sigmoid_deriv(float x) {return 1.0/(1+exp(-x)) * (1 - 1.0/(1+exp(x)));}
+float sigmoid(float x) {return 1.0f/(1+std::exp(-x));}
+float sigmoid_deriv(float x) {float s = sigmoid(x); return s * (1 - s);}
 
 float linear(float x) {return x;}
 float linear_deriv(float x) {return 1;}
 
-float lecun_tanh(float x) {return 1.7159 * tanh((2.0/3) * x);}
-float lecun_tanh_deriv(float x) {return 1.14393 * pow(1.0/cosh(2.0/3 * x),2);}
+float lecun_tanh(float x) {return 1.7159f * std::tanh((2.0f/3) * x);}
+float lecun_tanh_deriv(float x) {float t = std::tanh((2.0f/3) * x); return 1.14393f * (1 - t*t);}
 
-float inverse_logit(float x) {return (exp(x)/(exp(x)+1));}
-float inverse_logit_deriv(float x) {return (exp(x)/pow(exp(x)+1, 2));}
+float inverse_logit(float x) {return sigmoid(x);}
+float inverse_logit_deriv(float x) {return sigmoid_deriv(x);}
 
-float softplus(float x) {return log(1+exp(x));}
-float softplus_deriv(float x) {return exp(x)/(exp(x)+1);}
+float softplus(float x) {return std::max(x, 0.0f) + std::log1p(std::exp(-std::abs(x)));}
+float softplus_deriv(float x) {return sigmoid(x);}
 
-float cloglog(float x) {return 1-exp(-exp(x));}
-float cloglog_deriv(float x) {return exp(x-exp(x));}
+float cloglog(float x) {return 1-std::exp(-std::exp(x));}
+float cloglog_deriv(float x) {float e = std::exp(x); return e * std::exp(-e);}
 
 float step(float x)
 {
@@ -57,3 +63,39 @@ std::function<float(float)> rectifier(float (*activation)(float))
   return rectified;
 }
 
+
+// The built-in activations run through the kernel table picked for this CPU (see kernels.hpp),
+// which computes the activation and its derivative in one vectorized sweep.
+void apply_activation(Activation kind, float* z, float* dz, Eigen::Index n)
+{
+  kernels->activate(kind, z, dz, n);
+}
+
+// Inference-only variant: no derivative is computed or stored.
+void apply_activation(Activation kind, float* z, Eigen::Index n)
+{
+  kernels->activate_forward(kind, z, n);
+}
+
+void apply_activation(Activation kind, const std::function<float(float)>& custom, float* z, Eigen::Index n)
+{
+  if (kind != Activation::Custom) {
+    apply_activation(kind, z, n);
+    return;
+  }
+  for (Eigen::Index i = 0; i < n; i++) z[i] = custom(z[i]);
+}
+
+Activation parse_activation(const char* name)
+{
+  if (strcmp(name, "linear") == 0) return Activation::Linear;
+  if (strcmp(name, "sigmoid") == 0) return Activation::Sigmoid;
+  if (strcmp(name, "step") == 0) return Activation::Step;
+  if (strcmp(name, "lecun_tanh") == 0) return Activation::LecunTanh;
+  if (strcmp(name, "inverse_logit") == 0) return Activation::InverseLogit;
+  if (strcmp(name, "cloglog") == 0) return Activation::Cloglog;
+  if (strcmp(name, "softplus") == 0) return Activation::Softplus;
+  if (strcmp(name, "relu") == 0) return Activation::Relu;
+  if (strcmp(name, "resig") == 0) return Activation::Resig;
+  return Activation::Custom;
+}
@@ -2,6 +2,12 @@
 #define UTILS_H
 
 #include <functional>
+#include <Eigen/Dense>
+
+// Built-in activations. These run through apply_activation, which computes the
+// activation and its derivative together in one vectorized sweep. Custom marks a
+// layer whose functions were set by the user and must go through std::function.
+enum class Activation { Linear, Sigmoid, Step, LecunTanh, InverseLogit, Cloglog, Softplus, Relu, Resig, Custom };
 
 // A zoo of activation functions.
 float sigmoid(float x);
@@ -24,6 +30,16 @@ float inverse_logit(float x);
 float inverse_logit_deriv(float x);
 std::function<float(float)> rectifier(float (*activation)(float));
 
+// The built-in activation add_layer knows by this name, or Activation::Custom.
+Activation parse_activation(const char* name);
+
+// Overwrites z[0..n) with the activation and writes its derivative into dz[0..n).
+void apply_activation(Activation kind, float* z, float* dz, Eigen::Index n);
+// Overwrites z[0..n) with the activation only.
+void apply_activation(Activation kind, float* z, Eigen::Index n);
+// Same, falling back to `custom` element by element when kind is Activation::Custom.
+void apply_activation(Activation kind, const std::function<float(float)>& custom, float* z, Eigen::Index n);
+
 Eigen::MatrixXf strassen_mul(Eigen::MatrixXf a, Eigen::MatrixXf b);
 
 #endif /* MODULE_H */
@@ -0,0 +1,105 @@
+#include "validation.hpp"
+#include "kernels.hpp"
+#include "trace.hpp"
+
+Validator::Validator(std::vector<Layer>& layers, const Parameters& params, int batch, int members)
+  :member_loss(members, 0), member_accuracy(members, 0), batch{batch}, members{members}, size{params.size}
+{
+  parameter_layout(layers, weight_at, bias_at);
+  int widest = 0;
+  for (Layer& layer : layers) {
+    nodes.push_back(layer.contents->cols());
+    kinds.push_back(layer.activation_kind);
+    custom.push_back(layer.activation);
+    widest = std::max(widest, nodes.back());
+  }
+  front.resize((size_t)batch * widest);
+  back.resize((size_t)batch * widest);
+}
+
+Validator::~Validator()
+{
+  if (worker.joinable()) worker.join();
+  free(snapshot);
+}
+
+// Scores every cached row against parameters laid out like Parameters, batch rows at a time.
+void Validator::run(const float* parameters)
+{
+  TRACE("validate");
+  int rows = features.rows();
+  int length = nodes.size();
+  int classes = nodes[length-1] / members;
+  std::vector<OutputStats> totals (members);
+  for (int start = 0; start < rows; start += batch) {
+    int n = std::min(batch, rows - start);
+    float* in = front.data();
+    float* out = back.data();
+    Eigen::Map<Eigen::MatrixXf> (in, n, nodes[0]) = features.middleRows(start, n);
+    apply_activation(kinds[0], custom[0], in, (Eigen::Index)n * nodes[0]);
+    for (int i = 0; i < length-1; i++) {
+      Eigen::Map<const Eigen::MatrixXf, Eigen::Aligned64> w (parameters + weight_at[i], nodes[i], nodes[i+1]);
+      Eigen::Map<const Eigen::RowVectorXf, Eigen::Aligned64> b (parameters + bias_at[i+1], nodes[i+1]);
+      Eigen::Map<Eigen::MatrixXf> z (out, n, nodes[i+1]);
+      z.noalias() = Eigen::Map<const Eigen::MatrixXf> (in, n, nodes[i]) * w;
+      z.rowwise() += b;
+      apply_activation(kinds[i+1], custom[i+1], out, (Eigen::Index)n * nodes[i+1]);
+      std::swap(in, out);
+    }
+    for (int k = 0; k < members; k++) {
+      float sum = kernels->softmax_loss(in + (Eigen::Index)k*classes*n, n, classes, 1, n, labels.data() + start, nullptr,
+                                        &totals[k].loss, &totals[k].correct);
+      checknan(sum, "sum in Softmax operation");
+    }
+  }
+  for (int k = 0; k < members; k++) {
+    member_loss[k] = rows > 0 ? totals[k].loss / rows : 0;
+    member_accuracy[k] = rows > 0 ? totals[k].correct / rows : 0;
+  }
+  loss = member_loss[0];
+  accuracy = member_accuracy[0];
+}
+
+// Copies the parameters (one flat copy, values only) and scores the copy on a background thread.
+// Waits for the previous run first.
+void Validator::start(const float* parameters, float squared_weights)
+{
+  wait();
+  if (snapshot == nullptr) snapshot = (float*) aligned_alloc(64, size * sizeof(float));
+  std::copy(parameters, parameters + size, snapshot);
+  squares = squared_weights;
+  finished.store(false);
+  worker = std::thread([this]() {
+    try {
+      run(snapshot);
+    }
+    catch (...) {
+      error = std::current_exception();
+    }
+    finished.store(true, std::memory_order_release);
+  });
+}
+
+// Whether the background run is done, so wait() would not block.
+bool Validator::ready()
+{
+  return finished.load(std::memory_order_acquire);
+}
+
+// Joins the background run, rethrowing anything it threw.
+void Validator::wait()
+{
+  if (!worker.joinable()) return;
+  worker.join();
+  if (error != nullptr) {
+    std::exception_ptr thrown = error;
+    error = nullptr;
+    std::rethrow_exception(thrown);
+  }
+}
+
+// Whether a background run has been started and not yet waited for.
+bool Validator::pending()
+{
+  return worker.joinable();
+}
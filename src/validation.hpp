@@ -0,0 +1,54 @@
+#ifndef VALIDATION_H
+#define VALIDATION_H
+
+#include "bpnn.hpp"
+
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <thread>
+#include <vector>
+
+// The validation split of a Network, gathered once into contiguous memory and scored forward-only
+// in large batches: activations without derivatives, no output error, and the last partial batch
+// included. It keeps its own copies of the topology, and start() scores a private snapshot of the
+// flat parameter buffer, so validation can run on a background thread while training goes on
+// changing the network's parameters. With members > 1 the output layer holds that many models side
+// by side (see Ensemble), each scored on its own block of columns.
+class Validator {
+public:
+  Eigen::MatrixXf features; // one row per validation row, filled by Network::load_rows
+  Eigen::MatrixXf labels;
+  float loss = 0; // mean cross-entropy of the last run (member 0's, with members)
+  float accuracy = 0;
+  std::vector<float> member_loss; // per member, for ensembles
+  std::vector<float> member_accuracy;
+  float squares = 0; // squared weights of the snapshot being scored, for the L2 term
+
+  Validator(std::vector<Layer>& layers, const Parameters& params, int batch, int members = 1);
+  ~Validator();
+  Validator(const Validator&) = delete;
+  void run(const float* parameters);
+  void start(const float* parameters, float squared_weights);
+  bool ready();
+  void wait();
+  bool pending();
+
+private:
+  int batch;
+  int members;
+  std::vector<int> nodes;
+  std::vector<Activation> kinds;
+  std::vector<std::function<float(float)>> custom;
+  std::vector<Eigen::Index> weight_at;
+  std::vector<Eigen::Index> bias_at;
+  Eigen::Index size;
+  std::vector<float> front; // ping-pong activations, batch x widest
+  std::vector<float> back;
+  float* snapshot = nullptr;
+  std::thread worker;
+  std::atomic<bool> finished {false};
+  std::exception_ptr error;
+};
+
+#endif /* VALIDATION_H */
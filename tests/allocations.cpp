@@ -0,0 +1,65 @@
+//
+// allocations.cpp
+// Checks that a training epoch does not touch the heap once the first one has run, on both paths of
+// Network::micro_step (a batch trained in place, and one cut into micro-batches), with and without a
+// thread pool, for SGD and for Adam.
+//
+// malloc is interposed with a counter (glibc), which also catches operator new and Eigen's own allocations.
+// Build next to the library sources, e.g.
+//   g++ -std=c++2a -O2 tests/allocations.cpp src/bpnn.cpp src/utils.cpp src/dataset.cpp src/pipeline.cpp src/threadpool.cpp src/optimizer.cpp src/trace.cpp src/validation.cpp src/snapshot.cpp src/kernels*.cpp -lpthread -o allocations
+// and pass an optimizer name as the second argument to check only that one.
+//
+
+#include "../src/bpnn.hpp"
+#include "../src/utils.hpp"
+#include <atomic>
+#include <cassert>
+
+extern "C" void* __libc_malloc(size_t size);
+
+static std::atomic<long> allocations {0};
+
+extern "C" void* malloc(size_t size)
+{
+  allocations++;
+  return __libc_malloc(size);
+}
+
+// Allocations made by the second epoch of train_epoch. The first one builds the replicas and gets
+// lazily allocated library state (stdio buffers etc.) out of the way.
+static long epoch_allocations(char* path, int batch, int threads, const char* optimizer)
+{
+  Network net (path, batch, 0.0155, 0.03, 0.001, 0.9);
+  net.add_layer(4, (char*)"linear");
+  net.add_layer(64, (char*)"lecun_tanh");
+  net.add_layer(32, (char*)"relu");
+  net.add_layer(2, (char*)"linear");
+  net.initialize();
+  net.init_optimizer((char*)optimizer, 0.9, 0.999, 1e-8);
+  net.set_threads(threads);
+  float cost_sum = 0, acc_sum = 0;
+  net.train_epoch(cost_sum, acc_sum);
+  long before = allocations;
+  net.train_epoch(cost_sum, acc_sum);
+  return allocations - before;
+}
+
+int main(int argc, char** argv)
+{
+  char* path = argc > 1 ? argv[1] : (char*)"./data_banknote_authentication.txt";
+  std::vector<const char*> optimizers = {"sgd", "adam"};
+  if (argc > 2) optimizers = {argv[2]};
+  long total = 0;
+  for (const char* optimizer : optimizers) {
+    for (int batch : {16, 100}) {
+      for (int threads : {1, 2}) {
+        long counted = epoch_allocations(path, batch, threads, optimizer);
+        std::cout << "Allocations over a training epoch (" << optimizer << ", batch " << batch << ", "
+                  << threads << (threads == 1 ? " thread" : " threads") << "): " << counted << "\n";
+        total += counted;
+      }
+    }
+  }
+  assert(total == 0);
+  return 0;
+}
@@ -0,0 +1,303 @@
+//
+// bench.cpp
+// Microbenchmarks of the training loop over network shapes, batch sizes, activations and optimizers.
+//
+// Every case trains on random in-memory data (no file I/O) and times each phase on its own: loading
+// a batch, the forward pass, backprop, the optimizer update, a whole step, and a whole epoch. Each
+// phase is warmed up, then sampled until the standard error of the mean drops under --tolerance (or
+// its time budget runs out), and results are written as JSON. Build it with `make bench` or
+// `make bench-faster` and compare two runs with scripts/compare_bench.py, e.g.
+//   make bench && ./bench --out fast.json
+//   make bench-faster && ./bench --out faster.json
+//   python3 scripts/compare_bench.py fast.json faster.json
+//
+// Without --grid the suite sweeps one parameter at a time around width 256, depth 2, batch 64, relu
+// and sgd. --widths, --depths, --batches, --activations and --optimizers (comma separated) replace
+// a sweep's values; --grid runs every combination instead.
+//
+
+#include "../src/bpnn.hpp"
+#include "../src/utils.hpp"
+#include "../src/kernels.hpp"
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <sstream>
+
+#ifndef BENCH_CONFIG
+#define BENCH_CONFIG "custom"
+#endif
+
+#define BENCH_INPUTS 64
+#define BENCH_CLASSES 10
+
+struct Case {
+  int width;
+  int depth;
+  int batch;
+  std::string activation;
+  std::string optimizer;
+
+  std::string name() const
+  {
+    return "w" + std::to_string(width) + "_d" + std::to_string(depth) + "_b" + std::to_string(batch) + "_" + activation + "_" + optimizer;
+  }
+  bool operator==(const Case& other) const
+  {
+    return name() == other.name();
+  }
+};
+
+struct Options {
+  std::vector<int> widths = {4, 16, 64, 256, 1024, 4096};
+  std::vector<int> depths = {1, 2, 4, 8};
+  std::vector<int> batches = {1, 8, 32, 64, 128, 512};
+  std::vector<std::string> activations = {"linear", "relu", "sigmoid", "lecun_tanh", "softplus"};
+  std::vector<std::string> optimizers = {"sgd", "momentum", "adam"};
+  std::vector<std::string> phases = {"load", "forward", "backward", "update", "step", "epoch"};
+  bool grid = false;
+  int rows = 4096; // rows of random data, split 90/10 into training and validation
+  double warmup = 0.05; // seconds of warm-up per phase
+  double sample = 0.002; // target seconds per sample; fast phases are repeated to fill it
+  double tolerance = 0.01; // relative standard error of the mean at which a phase counts as stable
+  int min_samples = 10;
+  int max_samples = 1000;
+  double budget = 2; // seconds per phase before giving up on stability
+  const char* out = nullptr;
+};
+
+struct Stats {
+  double median;
+  double mean;
+  double stddev;
+  double min;
+  int samples;
+  long reps; // calls per sample
+  bool stable;
+};
+
+static double now()
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Warms `op` up, picks how many calls make one sample, then samples until the mean is known to
+// within the tolerance. Times are per call, in microseconds.
+Stats measure(const std::function<void()>& op, const Options& opts)
+{
+  double start = now();
+  long calls = 0;
+  do {
+    op();
+    calls++;
+  } while (now() - start < opts.warmup);
+  double estimate = (now() - start) / calls;
+  long reps = std::max(1L, (long) (opts.sample / estimate));
+
+  std::vector<double> times;
+  double rse = INFINITY;
+  start = now();
+  while ((int) times.size() < opts.max_samples) {
+    double begin = now();
+    for (long i = 0; i < reps; i++) op();
+    times.push_back((now() - begin) / reps * 1e6);
+    int n = times.size();
+    if (n >= 2) {
+      double mean = 0;
+      for (double t : times) mean += t;
+      mean /= n;
+      double var = 0;
+      for (double t : times) var += (t - mean) * (t - mean);
+      rse = std::sqrt(var / (n-1) / n) / mean;
+    }
+    if (n >= opts.min_samples && rse < opts.tolerance) break;
+    if (now() - start > opts.budget) break;
+  }
+
+  Stats stats;
+  int n = times.size();
+  stats.samples = n;
+  stats.reps = reps;
+  stats.stable = rse < opts.tolerance;
+  stats.mean = 0;
+  for (double t : times) stats.mean += t;
+  stats.mean /= n;
+  stats.stddev = 0;
+  for (double t : times) stats.stddev += (t - stats.mean) * (t - stats.mean);
+  stats.stddev = n > 1 ? std::sqrt(stats.stddev / (n-1)) : 0;
+  std::sort(times.begin(), times.end());
+  stats.median = n % 2 ? times[n/2] : (times[n/2-1] + times[n/2]) / 2;
+  stats.min = times[0];
+  return stats;
+}
+
+Network* build(const Case& c, Dataset& data)
+{
+  Network* net = new Network (&data, c.batch, 0.001, 0.001, 0, 0.9);
+  net->verbose = false;
+  net->seed(1);
+  net->add_layer(BENCH_INPUTS, (char*)"linear");
+  for (int i = 0; i < c.depth; i++) net->add_layer(c.width, (char*)c.activation.c_str());
+  net->add_layer(BENCH_CLASSES, (char*)"linear");
+  net->initialize();
+  if (c.optimizer != "sgd") net->init_optimizer((char*)c.optimizer.c_str(), 0.9, 0.999, 1e-8);
+  return net;
+}
+
+bool wanted(const Options& opts, const char* phase)
+{
+  return std::find(opts.phases.begin(), opts.phases.end(), phase) != opts.phases.end();
+}
+
+std::vector<std::pair<std::string, Stats>> run(const Case& c, Dataset& data, const Options& opts)
+{
+  std::vector<std::pair<std::string, Stats>> results;
+  Network* net = build(c, data);
+  int batches = net->instances / c.batch;
+  int k = 0;
+  auto load = [net, &k, batches]() -> void {
+    net->load_rows(net->train_rows.data() + (k++ % batches) * net->batch_size, net->batch_size, *net->layers[0].contents, *net->labels);
+  };
+  load();
+  if (wanted(opts, "load")) results.emplace_back("load", measure(load, opts));
+  if (wanted(opts, "forward")) results.emplace_back("forward", measure([net]() {net->feedforward();}, opts));
+  net->feedforward();
+  if (wanted(opts, "backward")) {
+    results.emplace_back("backward", measure([net]() {compute_gradients(net->layers, net->workspace);}, opts));
+  }
+  compute_gradients(net->layers, net->workspace);
+  if (wanted(opts, "update")) results.emplace_back("update", measure([net]() {net->apply_gradients(net->workspace, net->batch_size);}, opts));
+  if (wanted(opts, "step")) {
+    results.emplace_back("step", measure([net, &load]() {
+      load();
+      net->feedforward();
+      net->backpropagate();
+    }, opts));
+  }
+  delete net;
+  // The update benchmark keeps applying one gradient, so epochs start again from fresh weights.
+  if (wanted(opts, "epoch")) {
+    net = build(c, data);
+    Options once = opts;
+    once.warmup = 0;
+    once.sample = 0;
+    once.min_samples = std::min(opts.min_samples, 5);
+    results.emplace_back("epoch", measure([net]() {net->train();}, once));
+    delete net;
+  }
+  return results;
+}
+
+std::vector<Case> cases(const Options& opts)
+{
+  std::vector<Case> all;
+  auto add = [&all](Case c) -> void {
+    if (std::find(all.begin(), all.end(), c) == all.end()) all.push_back(c);
+  };
+  if (opts.grid) {
+    for (int w : opts.widths) for (int d : opts.depths) for (int b : opts.batches)
+      for (const std::string& a : opts.activations) for (const std::string& o : opts.optimizers) add({w, d, b, a, o});
+    return all;
+  }
+  Case base = {256, 2, 64, "relu", "sgd"};
+  for (int w : opts.widths) add({w, base.depth, base.batch, base.activation, base.optimizer});
+  for (int d : opts.depths) add({base.width, d, base.batch, base.activation, base.optimizer});
+  for (int b : opts.batches) add({base.width, base.depth, b, base.activation, base.optimizer});
+  for (const std::string& a : opts.activations) add({base.width, base.depth, base.batch, a, base.optimizer});
+  for (const std::string& o : opts.optimizers) add({base.width, base.depth, base.batch, base.activation, o});
+  return all;
+}
+
+template <typename T>
+std::vector<T> split_list(const char* arg)
+{
+  std::vector<T> values;
+  std::stringstream list (arg);
+  std::string item;
+  while (std::getline(list, item, ',')) {
+    std::stringstream value (item);
+    T v;
+    value >> v;
+    values.push_back(v);
+  }
+  return values;
+}
+
+void usage(const char* program)
+{
+  fprintf(stderr, "usage: %s [--grid] [--widths 4,256] [--depths 1,2] [--batches 16,64] [--activations relu,sigmoid]\n"
+          "  [--optimizers sgd,adam] [--phases load,forward,backward,update,step,epoch] [--rows 4096]\n"
+          "  [--tolerance 0.01] [--budget 2] [--out results.json]\n", program);
+  exit(1);
+}
+
+int main(int argc, char** argv)
+{
+  Options opts;
+  for (int i = 1; i < argc; i++) {
+    const char* flag = argv[i];
+    if (strcmp(flag, "--grid") == 0) {
+      opts.grid = true;
+      continue;
+    }
+    if (i+1 >= argc) usage(argv[0]);
+    const char* value = argv[++i];
+    if (strcmp(flag, "--widths") == 0) opts.widths = split_list<int>(value);
+    else if (strcmp(flag, "--depths") == 0) opts.depths = split_list<int>(value);
+    else if (strcmp(flag, "--batches") == 0) opts.batches = split_list<int>(value);
+    else if (strcmp(flag, "--activations") == 0) opts.activations = split_list<std::string>(value);
+    else if (strcmp(flag, "--optimizers") == 0) opts.optimizers = split_list<std::string>(value);
+    else if (strcmp(flag, "--phases") == 0) opts.phases = split_list<std::string>(value);
+    else if (strcmp(flag, "--rows") == 0) opts.rows = atoi(value);
+    else if (strcmp(flag, "--tolerance") == 0) opts.tolerance = atof(value);
+    else if (strcmp(flag, "--budget") == 0) opts.budget = atof(value);
+    else if (strcmp(flag, "--out") == 0) opts.out = value;
+    else usage(argv[0]);
+  }
+
+  std::mt19937 gen (1);
+  std::normal_distribution<float> feature (0, 1);
+  std::uniform_int_distribution<int> label (0, BENCH_CLASSES-1);
+  std::vector<float> features (opts.rows * BENCH_INPUTS);
+  std::vector<float> labels (opts.rows);
+  for (float& f : features) f = feature(gen);
+  for (float& l : labels) l = label(gen);
+  Dataset data (features.data(), labels.data(), opts.rows, BENCH_INPUTS);
+
+  FILE* out = opts.out != nullptr ? fopen(opts.out, "w") : stdout;
+  if (out == NULL) {
+    fprintf(stderr, "Unable to write `%s`\n", opts.out);
+    return 1;
+  }
+  fprintf(out, "{\n\"build\": {\"config\": \"%s\", \"compiler\": \"%s\", \"eigen\": \"%d.%d.%d\", \"simd\": \"%s\", \"kernels\": \"%s\", \"ndebug\": %s, \"mkl\": %s},\n",
+          BENCH_CONFIG, __VERSION__, EIGEN_WORLD_VERSION, EIGEN_MAJOR_VERSION, EIGEN_MINOR_VERSION, Eigen::SimdInstructionSetsInUse(), kernel_path(),
+#ifdef NDEBUG
+          "true",
+#else
+          "false",
+#endif
+#ifdef EIGEN_USE_MKL_ALL
+          "true");
+#else
+          "false");
+#endif
+  fprintf(out, "\"rows\": %d, \"inputs\": %d, \"classes\": %d,\n\"cases\": [", opts.rows, BENCH_INPUTS, BENCH_CLASSES);
+  std::vector<Case> all = cases(opts);
+  for (size_t i = 0; i < all.size(); i++) {
+    const Case& c = all[i];
+    fprintf(stderr, "[%zu/%zu] %s\n", i+1, all.size(), c.name().c_str());
+    fprintf(out, "%s\n{\"name\": \"%s\", \"width\": %d, \"depth\": %d, \"batch\": %d, \"activation\": \"%s\", \"optimizer\": \"%s\", \"phases\": {",
+            i == 0 ? "" : ",", c.name().c_str(), c.width, c.depth, c.batch, c.activation.c_str(), c.optimizer.c_str());
+    std::vector<std::pair<std::string, Stats>> results = run(c, data, opts);
+    for (size_t j = 0; j < results.size(); j++) {
+      const Stats& s = results[j].second;
+      fprintf(out, "%s\n  \"%s\": {\"median_us\": %.3f, \"mean_us\": %.3f, \"stddev_us\": %.3f, \"min_us\": %.3f, \"samples\": %d, \"reps\": %ld, \"stable\": %s}",
+              j == 0 ? "" : ",", results[j].first.c_str(), s.median, s.mean, s.stddev, s.min, s.samples, s.reps, s.stable ? "true" : "false");
+    }
+    fprintf(out, "}}");
+    fflush(out);
+  }
+  fprintf(out, "\n]}\n");
+  if (out != stdout) fclose(out);
+}
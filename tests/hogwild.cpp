@@ -0,0 +1,51 @@
+//
+// hogwild.cpp
+// Convergence benchmark of asynchronous (Hogwild) SGD against the sequential train() loop.
+//
+// Trains the small banknote network from example.cpp at batch size 1 with the same seed, once
+// sequentially and then with an increasing number of lock-free workers, and reports wall time and
+// where each run ended up. Build next to the library sources, e.g.
+//   g++ -std=c++2a -O3 tests/hogwild.cpp src/bpnn.cpp src/utils.cpp src/dataset.cpp src/pipeline.cpp src/threadpool.cpp src/optimizer.cpp src/trace.cpp src/validation.cpp src/snapshot.cpp src/kernels*.cpp -lpthread -o hogwild
+//
+
+#include "../src/bpnn.hpp"
+#include "../src/utils.hpp"
+#include <chrono>
+
+struct Result {
+  double seconds;
+  float val_cost;
+  float val_acc;
+};
+
+Result run(char* path, int threads, int epochs)
+{
+  Network net (path, 1, 0.0155, 0.03, 0, 0.9);
+  net.seed(1);
+  net.add_layer(4, (char*)"linear");
+  net.add_layer(5, (char*)"lecun_tanh");
+  net.add_layer(2, (char*)"linear");
+  net.initialize();
+  if (threads > 1) net.set_async(threads);
+  auto start = std::chrono::high_resolution_clock::now();
+  for (int i = 0; i < epochs; i++) {
+    net.train();
+  }
+  auto end = std::chrono::high_resolution_clock::now();
+  return {std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / pow(10,9), net.get_val_cost(), net.get_val_acc()};
+}
+
+int main(int argc, char** argv)
+{
+  char* path = argc > 1 ? argv[1] : (char*)"./data_banknote_authentication.txt";
+  int epochs = argc > 2 ? strtol(argv[2], NULL, 10) : 20;
+  int cores = std::thread::hardware_concurrency();
+  std::vector<Result> results;
+  std::vector<int> configs = {1};
+  for (int threads = 2; threads <= std::max(cores, 2); threads *= 2) configs.push_back(threads);
+  for (int threads : configs) results.push_back(run(path, threads, epochs));
+  printf("\n%-10s %-10s %-10s %-10s %-10s\n", "threads", "time", "speedup", "val_cost", "val_acc");
+  for (int i = 0; i < configs.size(); i++) {
+    printf("%-10d %-10.4f %-10.2f %-10.4f %-10.4f\n", configs[i], results[i].seconds, results[0].seconds / results[i].seconds, results[i].val_cost, results[i].val_acc);
+  }
+}